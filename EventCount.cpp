@@ -0,0 +1,143 @@
+#include "EventCount.h"
+
+#include <climits>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+#include <cerrno>
+#endif
+
+namespace {
+
+#ifdef __linux__
+// Not FUTEX_PRIVATE_FLAG: the word is shared between processes
+void futexWait(std::atomic<uint32_t>* addr, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT, expected, nullptr, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t>* addr, int count) {
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
+
+void futexWait(std::atomic<uint32_t>* addr, uint32_t expected, int timeoutMs) {
+    timespec timeout{timeoutMs / 1000, (long)(timeoutMs % 1000) * 1000000};
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT, expected, timeoutMs >= 0 ? &timeout : nullptr, nullptr, 0);
+}
+#endif
+
+}
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be plain 32-bit integers");
+
+EventCount::EventCount(EventWord* word, [[maybe_unused]] const std::wstring& name)
+    : word(word)
+#ifdef _WIN32
+    , park(std::make_unique<Semaphore>(name, 0, INT_MAX))
+#endif
+{}
+
+EventCount::~EventCount() = default;
+
+uint32_t EventCount::prepareWait() {
+    word->waiters.fetch_add(1, std::memory_order_seq_cst);
+    return word->epoch.load(std::memory_order_seq_cst);
+}
+
+void EventCount::cancelWait() {
+    word->waiters.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+void EventCount::wait(uint32_t key) {
+    if (word->epoch.load(std::memory_order_acquire) == key) {
+#if defined(_WIN32)
+        // Stale credits from cancelled waits only cause a spurious wake-up
+        park->acquire();
+#elif defined(__linux__)
+        futexWait(&word->epoch, key);
+#else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+    }
+    word->waiters.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+void EventCount::notify(int count) {
+    // Pairs with the increment in prepareWait: either we see the waiter, or it sees what we published
+    // (a locked read-modify-write is cheaper than a full fence on x86)
+    uint32_t waiters = word->waiters.fetch_add(0, std::memory_order_seq_cst);
+    if (waiters == 0) {
+        return;
+    }
+    word->epoch.fetch_add(1, std::memory_order_seq_cst);
+#if defined(_WIN32)
+    park->release(std::min<int>(count, waiters));
+#elif defined(__linux__)
+    futexWake(&word->epoch, count);
+#endif
+}
+
+void EventCount::waitAny(EventCount* const* events, const uint32_t* keys, int count, int timeoutMs) {
+    for (int i = 0; i < count; ++i) {
+        if (events[i]->word->epoch.load(std::memory_order_acquire) != keys[i]) {
+            return;
+        }
+    }
+#if defined(_WIN32)
+    std::vector<HANDLE> handles;
+    for (int i = 0; i < count && i < MAXIMUM_WAIT_OBJECTS; ++i) {
+        handles.push_back(events[i]->park->handle());
+    }
+    if (handles.empty()) {
+        Sleep(timeoutMs < 0 ? INFINITE : timeoutMs);
+    } else {
+        WaitForMultipleObjects((DWORD)handles.size(), handles.data(), FALSE, timeoutMs < 0 ? INFINITE : timeoutMs);
+    }
+#elif defined(__linux__)
+    if (count == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs < 0 ? INT_MAX : timeoutMs));
+        return;
+    }
+    if (count == 1) {
+        futexWait(&events[0]->word->epoch, keys[0], timeoutMs);
+        return;
+    }
+#ifdef SYS_futex_waitv
+    // Shared futexes, so no FUTEX_PRIVATE_FLAG here either
+    std::vector<futex_waitv> waiters(std::min(count, 128));
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        waiters[i] = futex_waitv{keys[i], (uint64_t)(uintptr_t)&events[i]->word->epoch, FUTEX_32, 0};
+    }
+    timespec deadline{};
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000;
+    }
+    if (syscall(SYS_futex_waitv, waiters.data(), waiters.size(), 0, timeoutMs >= 0 ? &deadline : nullptr, CLOCK_MONOTONIC) >= 0
+        || errno != ENOSYS) {
+        return;
+    }
+#endif
+    // Kernels before 5.16 can only park on one word, the others are looked at every millisecond
+    futexWait(&events[0]->word->epoch, keys[0], timeoutMs < 0 ? 1 : std::min(timeoutMs, 1));
+#else
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+}
+
+int spinCount() {
+    return std::thread::hardware_concurrency() > 1 ? 100 : 0;
+}
+
+void EventCount::remove(const std::wstring& name) {
+    Semaphore::remove(name);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Semaphore.h"
+#include "platform.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <memory>
+
+// Lives in shared memory next to the ring it guards, zeroed memory is a valid initial state
+struct EventWord {
+    std::atomic<uint32_t> epoch;
+    std::atomic<uint32_t> waiters;
+};
+
+// Event count over a shared word: waiters spin briefly, then park on a futex (Linux) or a
+// named semaphore (Windows, WaitOnAddress does not work across processes). Notifiers only
+// enter the kernel when somebody is actually parked.
+//
+//     while (!tryTake()) {
+//         uint32_t key = event.prepareWait();
+//         if (tryTake()) { event.cancelWait(); break; }
+//         event.wait(key);
+//     }
+class EventCount {
+public:
+    // The name is only used for the Windows parking semaphore
+    EventCount(EventWord* word, const std::wstring& name);
+    ~EventCount();
+
+    uint32_t prepareWait();
+    void cancelWait();
+    void wait(uint32_t key);
+
+    void notify(int count = 1);
+
+    // Parks on several event counts at once until one of them fires or the timeout runs out,
+    // -1 waits forever. Every one needs a prepareWait first and a cancelWait after, wait-style.
+    static void waitAny(EventCount* const* events, const uint32_t* keys, int count, int timeoutMs);
+
+    static void remove(const std::wstring& name);
+
+private:
+    EventWord* word;
+#ifdef _WIN32
+    std::unique_ptr<Semaphore> park;
+#endif
+};
+
+// Spinning is pointless on a single core, the other side cannot run meanwhile
+int spinCount();
+
+// Spins on the condition before falling back to parking on the event count
+template<typename F>
+void waitFor(EventCount& event, F tryTake, int spins) {
+    for (int i = 0; i < spins; ++i) {
+        if (tryTake()) {
+            return;
+        }
+        cpuRelax();
+    }
+    while (!tryTake()) {
+        uint32_t key = event.prepareWait();
+        if (tryTake()) {
+            event.cancelWait();
+            return;
+        }
+        event.wait(key);
+    }
+}
+
+template<typename F>
+void waitFor(EventCount& event, F tryTake) {
+    static const int SPIN_COUNT = spinCount();
+    waitFor(event, tryTake, SPIN_COUNT);
+}
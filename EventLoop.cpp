@@ -0,0 +1,178 @@
+#include "EventLoop.h"
+
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+Task Task::promise_type::get_return_object() {
+    return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+}
+
+std::suspend_always Task::promise_type::initial_suspend() noexcept {
+    return {};
+}
+
+void Task::promise_type::return_void() {}
+
+void Task::promise_type::unhandled_exception() {
+    std::terminate();
+}
+
+Task::Task(std::coroutine_handle<promise_type> handle)
+    : handle(handle)
+{}
+
+Task::Task(Task&& other) noexcept
+    : handle(std::exchange(other.handle, nullptr))
+{}
+
+Task& Task::operator=(Task&& other) noexcept {
+    if (this != &other) {
+        if (handle) {
+            handle.destroy();
+        }
+        handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+}
+
+Task::~Task() {
+    if (handle) {
+        handle.destroy();
+    }
+}
+
+bool Task::done() const {
+    return !handle || handle.done();
+}
+
+bool Task::await_ready() const {
+    return done();
+}
+
+EventLoop::Sleep::Sleep(Clock::duration duration) {
+    deadline = Clock::now() + duration;
+}
+
+bool EventLoop::Sleep::ready() {
+    return Clock::now() >= deadline;
+}
+
+bool EventLoop::Sleep::await_ready() {
+    return ready();
+}
+
+EventLoop::~EventLoop() {
+    destroyTasks();
+}
+
+void EventLoop::spawn(Task task) {
+    task.handle.promise().loop = this;
+    starting.push_back(task.handle);
+    tasks.push_back(std::move(task));
+}
+
+void EventLoop::run() {
+    stopped = false;
+    while (!stopped && !tasks.empty()) {
+        if (!resumeReady()) {
+            park();
+        }
+        tasks.erase(std::remove_if(tasks.begin(), tasks.end(), [](const Task& task) {
+            return task.done();
+        }), tasks.end());
+    }
+    destroyTasks();
+}
+
+void EventLoop::stop() {
+    stopped = true;
+}
+
+EventLoop::Sleep EventLoop::sleep(Clock::duration duration) {
+    return Sleep(duration);
+}
+
+void EventLoop::suspend(Waiter& waiter, std::coroutine_handle<> handle) {
+    waiter.handle = handle;
+    waiters.push_back(&waiter);
+}
+
+bool EventLoop::resumeReady() {
+    bool progressed = false;
+    std::vector<std::coroutine_handle<>> fresh;
+    fresh.swap(starting);
+    for (std::coroutine_handle<> handle : fresh) {
+        handle.resume();
+        progressed = true;
+    }
+    // A task is resumed at most once per pass. One that was not ready gets another try whenever a
+    // task after it made progress, before the next one in the pass: whatever that freed goes to
+    // the earlier waiter first instead of to those behind it.
+    std::vector<Waiter*> pending;
+    pending.swap(waiters);
+    std::stable_sort(pending.begin(), pending.end(), [](const Waiter* a, const Waiter* b) {
+        return a->priority < b->priority;
+    });
+    std::vector<Waiter*> blocked;
+    for (Waiter* waiter : pending) {
+        if (stopped || !waiter->ready()) {
+            blocked.push_back(waiter);
+            continue;
+        }
+        waiter->handle.resume();
+        progressed = true;
+        retryBlocked(blocked);
+    }
+    // Those still waiting go first on the next pass, ahead of the tasks that just ran
+    waiters.insert(waiters.begin(), blocked.begin(), blocked.end());
+    return progressed;
+}
+
+void EventLoop::retryBlocked(std::vector<Waiter*>& blocked) {
+    bool retry = true;
+    while (retry && !stopped) {
+        retry = false;
+        for (size_t i = 0; i < blocked.size(); ++i) {
+            if (blocked[i]->ready()) {
+                Waiter* waiter = blocked[i];
+                blocked.erase(blocked.begin() + i);
+                waiter->handle.resume();
+                // It may have freed something for those before it
+                retry = true;
+                break;
+            }
+        }
+    }
+}
+
+void EventLoop::park() {
+    std::vector<EventCount*> events;
+    std::vector<uint32_t> keys;
+    Clock::time_point deadline = Clock::time_point::max();
+    for (Waiter* waiter : waiters) {
+        deadline = std::min(deadline, waiter->deadline);
+        if (waiter->event && std::find(events.begin(), events.end(), waiter->event) == events.end()) {
+            events.push_back(waiter->event);
+            keys.push_back(waiter->event->prepareWait());
+        }
+    }
+    // What came in before the registration would not wake us
+    if (!resumeReady()) {
+        int timeoutMs = -1;
+        if (deadline != Clock::time_point::max()) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            timeoutMs = (int)std::max<int64_t>(0, left);
+        }
+        EventCount::waitAny(events.data(), keys.data(), (int)events.size(), timeoutMs);
+    }
+    for (EventCount* event : events) {
+        event->cancelWait();
+    }
+}
+
+void EventLoop::destroyTasks() {
+    waiters.clear();
+    starting.clear();
+    tasks.clear();
+}
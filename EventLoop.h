@@ -0,0 +1,129 @@
+#pragma once
+
+#include "EventCount.h"
+
+#include <coroutine>
+#include <chrono>
+#include <vector>
+
+class EventLoop;
+
+// Coroutine run by an EventLoop. Spawned tasks belong to the loop, a task can also
+// co_await another one, which then runs right away and resumes it when it is done.
+class Task {
+public:
+    struct promise_type {
+        EventLoop* loop = nullptr;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object();
+        std::suspend_always initial_suspend() noexcept;
+        auto final_suspend() noexcept {
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                    std::coroutine_handle<> next = handle.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            return FinalAwaiter{};
+        }
+        void return_void();
+        void unhandled_exception();
+    };
+
+    Task() = default;
+    Task(Task&& other) noexcept;
+    Task& operator=(Task&& other) noexcept;
+    ~Task();
+
+    bool done() const;
+
+    bool await_ready() const;
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> awaiting) {
+        handle.promise().loop = awaiting.promise().loop;
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    void await_resume() {}
+
+private:
+    friend class EventLoop;
+    explicit Task(std::coroutine_handle<promise_type> handle);
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Runs any number of tasks on one thread. A task that has to wait is parked on an event count or
+// a deadline, and when every task waits the thread parks on all of those at once: nothing blocks
+// a task but its own wait, and nothing polls.
+class EventLoop {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // What a suspended task waits for. ready() is tried again whenever its event fires, its deadline
+    // passes or another task made progress, and it may change event and deadline for the next try.
+    class Waiter {
+    public:
+        virtual bool ready() = 0;
+
+        // Null for a wait on the deadline alone
+        EventCount* event = nullptr;
+        Clock::time_point deadline = Clock::time_point::max();
+        // Higher ones are tried later on every pass, after whatever the others handed back in it
+        int priority = 0;
+
+    protected:
+        ~Waiter() = default;
+
+    private:
+        friend class EventLoop;
+        std::coroutine_handle<> handle;
+    };
+
+    class Sleep : public Waiter {
+    public:
+        explicit Sleep(Clock::duration duration);
+
+        bool ready() override;
+        bool await_ready();
+        template<typename Promise>
+        void await_suspend(std::coroutine_handle<Promise> handle) {
+            handle.promise().loop->suspend(*this, handle);
+        }
+        void await_resume() {}
+    };
+
+    EventLoop() = default;
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    void spawn(Task task);
+    // Until every task is done or stop() is called
+    void run();
+    // Tasks still suspended are destroyed when run() returns, with whatever they hold
+    void stop();
+
+    Sleep sleep(Clock::duration duration);
+
+    void suspend(Waiter& waiter, std::coroutine_handle<> handle);
+
+private:
+    // Resumes every waiter that is ready now, false when none was
+    bool resumeReady();
+    // Resumes those of a pass that were not ready but are now, until none is
+    void retryBlocked(std::vector<Waiter*>& blocked);
+    // Parks the thread until an event fires or the nearest deadline
+    void park();
+    void destroyTasks();
+
+    std::vector<Task> tasks;
+    // Spawned and not started yet
+    std::vector<std::coroutine_handle<>> starting;
+    std::vector<Waiter*> waiters;
+    bool stopped = false;
+};
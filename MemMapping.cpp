@@ -0,0 +1,357 @@
+#include "MemMapping.h"
+
+#include "platform.h"
+
+#include <thread>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#endif
+
+const char* backingName(PageBacking backing) {
+    switch (backing) {
+    case PageBacking::Transparent: return "transparent huge pages";
+    case PageBacking::Huge: return "huge pages";
+    default: return "normal pages";
+    }
+}
+
+#ifdef _WIN32
+
+#ifndef FILE_MAP_LARGE_PAGES
+#define FILE_MAP_LARGE_PAGES 0x20000000
+#endif
+
+namespace {
+
+// Large pages need the lock memory privilege, granted to the account beforehand and enabled here
+bool enableLockMemory() {
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return false;
+    }
+    TOKEN_PRIVILEGES privileges{};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    // Succeeds without the privilege too, only the last error tells
+    bool enabled = LookupPrivilegeValueW(nullptr, L"SeLockMemoryPrivilege", &privileges.Privileges[0].Luid)
+        && AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+        && GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return enabled;
+}
+
+void touchPages(void* data, size_t size) {
+    SYSTEM_INFO info{};
+    GetSystemInfo(&info);
+    auto bytes = (volatile char*)data;
+    for (size_t offset = 0; offset < size; offset += info.dwPageSize) {
+        bytes[offset];
+    }
+}
+
+}
+
+MemMapping::MemMapping(const std::wstring& name, size_t size, const std::string& path, const MapOptions& options)
+    : mapView(nullptr)
+    , isFile(!path.empty())
+    , pageBacking(PageBacking::Normal)
+    , mapFile(nullptr)
+    , file(INVALID_HANDLE_VALUE)
+{
+    auto size64 = (uint64_t)size;
+    bool fileExisted = false;
+    if (isFile) {
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER fileSize{};
+        fileExisted = GetLastError() == ERROR_ALREADY_EXISTS && GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0;
+        if (fileExisted) {
+            size64 = 0;
+        }
+    }
+    size_t largePage = GetLargePageMinimum();
+    if (options.hugePages && !isFile && largePage != 0 && enableLockMemory()) {
+        // Large page sections are committed and locked in whole large pages
+        uint64_t rounded = (size64 + largePage - 1) / largePage * largePage;
+        mapFile = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES, (DWORD)(rounded >> 32), (DWORD)rounded, name.c_str());
+        isCreated = GetLastError() != ERROR_ALREADY_EXISTS;
+        // An existing section of normal pages refuses the large page view, it is opened below like any other
+        mapView = mapFile ? MapViewOfFile(mapFile, FILE_MAP_ALL_ACCESS | FILE_MAP_LARGE_PAGES, 0, 0, 0) : nullptr;
+        if (mapView) {
+            pageBacking = PageBacking::Huge;
+        } else if (mapFile) {
+            CloseHandle(mapFile);
+            mapFile = nullptr;
+        }
+    }
+    if (!mapView) {
+        // A zero size maps an existing file at its own size
+        mapFile = CreateFileMappingW(file, nullptr, PAGE_READWRITE | (isFile ? 0 : SEC_COMMIT), (DWORD)(size64 >> 32), (DWORD)size64, name.c_str());
+        isCreated = GetLastError() != ERROR_ALREADY_EXISTS && !fileExisted;
+        mapView = mapFile ? MapViewOfFile(mapFile, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+        if (!mapView) {
+            systemFailure(mapFile ? "MapViewOfFile" : "CreateFileMapping", posixName(name));
+        }
+    }
+
+    MEMORY_BASIC_INFORMATION info{};
+    VirtualQuery(mapView, &info, sizeof(info));
+    mapSize = info.RegionSize;
+    if (pageBacking == PageBacking::Huge) {
+        // Large pages are never paged out anyway
+        return;
+    }
+    if (options.prefault) {
+        // Locking past the minimum working set fails, so make room for the whole view first
+        SIZE_T minimum = 0;
+        SIZE_T maximum = 0;
+        GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum);
+        SetProcessWorkingSetSize(GetCurrentProcess(), minimum + mapSize, maximum + mapSize);
+    }
+    VirtualLock(mapView, mapSize);
+    if (options.prefault) {
+        touchPages(mapView, mapSize);
+    }
+}
+
+MemMapping::~MemMapping() {
+    if (pageBacking != PageBacking::Huge) {
+        VirtualUnlock(mapView, mapSize);
+    }
+    UnmapViewOfFile(mapView);
+    CloseHandle(mapFile);
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+}
+
+void MemMapping::flush(bool wait) {
+    if (!isFile) {
+        return;
+    }
+    // Queues the writes, only the file flush waits for them
+    FlushViewOfFile(mapView, 0);
+    if (wait) {
+        FlushFileBuffers(file);
+    }
+}
+
+void MemMapping::remove(const std::wstring& name) {
+    // Sections die with their last handle
+}
+
+#else
+
+namespace {
+
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+// Where hugetlbfs is mounted, empty when it is not
+std::string hugePagesMount() {
+    std::ifstream mounts("/proc/mounts");
+    std::string line;
+    while (std::getline(mounts, line)) {
+        std::istringstream fields(line);
+        std::string device, mountPoint, type;
+        fields >> device >> mountPoint >> type;
+        if (type == "hugetlbfs") {
+            return mountPoint;
+        }
+    }
+    return "";
+}
+
+size_t freeHugePages() {
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    size_t value = 0;
+    while (meminfo >> key >> value) {
+        if (key == "HugePages_Free:") {
+            return value;
+        }
+        meminfo.ignore(256, '\n');
+    }
+    return 0;
+}
+
+// Shared memory only gets transparent huge pages when the kernel allows them for shmem at all
+bool transparentShmem() {
+    std::ifstream setting("/sys/kernel/mm/transparent_hugepage/shmem_enabled");
+    std::string text((std::istreambuf_iterator<char>(setting)), std::istreambuf_iterator<char>());
+    return !text.empty() && text.find("[never]") == std::string::npos && text.find("[deny]") == std::string::npos;
+}
+
+std::string hugePagesPath(const std::wstring& name) {
+    std::string mount = hugePagesMount();
+    return mount.empty() ? "" : mount + posixName(name);
+}
+
+// Faults every page in up front, after any madvise so that it applies to them
+void prefaultPages(void* data, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(data, size, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+#endif
+    long pageSize = sysconf(_SC_PAGESIZE);
+    auto bytes = (volatile char*)data;
+    for (size_t offset = 0; offset < size; offset += pageSize) {
+        bytes[offset];
+    }
+}
+
+// Waits for the creator to size the object, which it does right after creating it
+size_t existingSize(int fd, const std::string& object) {
+    const uint64_t SIZE_WAIT_MS = 5000;
+    struct stat st{};
+    uint64_t start = monotonicMs();
+    while (fstat(fd, &st) == 0 && st.st_size == 0) {
+        if (monotonicMs() - start >= SIZE_WAIT_MS) {
+            std::fprintf(stderr, "%s was never sized, its creator is gone; remove it and start again\n", object.c_str());
+            std::abort();
+        }
+        std::this_thread::yield();
+    }
+    return st.st_size;
+}
+
+}
+
+MemMapping::MemMapping(const std::wstring& name, size_t size, const std::string& path, const MapOptions& options)
+    : mapView(MAP_FAILED)
+    , mapSize(size)
+    , isFile(!path.empty())
+    , pageBacking(PageBacking::Normal)
+{
+    int populate = options.prefault ? MAP_POPULATE : 0;
+    std::string shmName = posixName(name);
+    // Huge page segments live on hugetlbfs under the same name, joiners look there first
+    std::string hugePath = isFile ? "" : hugePagesPath(name);
+    int fd = hugePath.empty() ? -1 : ::open(hugePath.c_str(), O_RDWR);
+    isCreated = false;
+    // Peers already on normal shared memory keep it, a huge page copy next to it would be another pool
+    bool shmExists = false;
+    if (fd < 0 && !hugePath.empty() && options.hugePages) {
+        int probe = shm_open(shmName.c_str(), O_RDWR, 0666);
+        shmExists = probe >= 0;
+        if (shmExists) {
+            close(probe);
+        }
+    }
+    if (fd < 0 && !hugePath.empty() && options.hugePages && !shmExists && freeHugePages() * HUGE_PAGE_SIZE >= size) {
+        fd = ::open(hugePath.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+        isCreated = fd >= 0;
+        if (isCreated) {
+            mapSize = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+            // No huge pages after all, normal shared memory below
+            if (ftruncate(fd, mapSize) != 0) {
+                close(fd);
+                unlink(hugePath.c_str());
+                fd = -1;
+                isCreated = false;
+            }
+        }
+    } else if (fd >= 0) {
+        mapSize = existingSize(fd, hugePath);
+    }
+    if (fd >= 0) {
+        // Huge pages are reserved at map time, so this is where another user of the pool can beat us to them
+        mapView = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | populate, fd, 0);
+        if (mapView == MAP_FAILED && !isCreated) {
+            // Normal shared memory under the name would be a second pool next to the one the others use
+            systemFailure("mmap", hugePath);
+        }
+        // A creator that could not map it unlinks it and goes on below, joiners follow it there
+        struct stat st{};
+        if (mapView != MAP_FAILED && !isCreated && fstat(fd, &st) == 0 && st.st_nlink == 0) {
+            munmap(mapView, mapSize);
+            mapView = MAP_FAILED;
+        }
+        close(fd);
+        if (mapView != MAP_FAILED) {
+            pageBacking = PageBacking::Huge;
+        } else if (isCreated) {
+            unlink(hugePath.c_str());
+        }
+    }
+
+    if (mapView == MAP_FAILED) {
+        // Files need no name, processes find them by path
+        auto open = [&](int flags) {
+            return isFile ? ::open(path.c_str(), flags, 0666) : shm_open(shmName.c_str(), flags, 0666);
+        };
+        std::string object = isFile ? path : shmName;
+        mapSize = size;
+        fd = open(O_RDWR | O_CREAT | O_EXCL);
+        isCreated = fd >= 0;
+        if (isCreated) {
+            // Fresh objects are zero-filled, same as a new pagefile-backed section
+            if (ftruncate(fd, size) != 0) {
+                systemFailure("ftruncate", object);
+            }
+        } else {
+            fd = open(O_RDWR);
+            if (fd < 0) {
+                systemFailure(isFile ? "open" : "shm_open", object);
+            }
+            mapSize = existingSize(fd, object);
+        }
+        bool transparent = options.hugePages && !isFile && transparentShmem();
+        // Populating right away would fault in small pages before the advice is there
+        mapView = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | (transparent ? 0 : populate), fd, 0);
+        close(fd);
+        if (mapView == MAP_FAILED) {
+            systemFailure("mmap", object);
+        }
+        if (transparent && madvise(mapView, mapSize, MADV_HUGEPAGE) == 0) {
+            pageBacking = PageBacking::Transparent;
+        }
+        if (transparent && options.prefault) {
+            prefaultPages(mapView, mapSize);
+        }
+    }
+    mlock(mapView, mapSize);
+}
+
+MemMapping::~MemMapping() {
+    munlock(mapView, mapSize);
+    munmap(mapView, mapSize);
+}
+
+void MemMapping::remove(const std::wstring& name) {
+    shm_unlink(posixName(name).c_str());
+    std::string hugePath = hugePagesPath(name);
+    if (!hugePath.empty()) {
+        unlink(hugePath.c_str());
+    }
+}
+
+void MemMapping::flush(bool wait) {
+    if (isFile) {
+        msync(mapView, mapSize, wait ? MS_SYNC : MS_ASYNC);
+    }
+}
+
+#endif
+
+size_t MemMapping::size() const {
+    return mapSize;
+}
+
+bool MemMapping::created() const {
+    return isCreated;
+}
+
+PageBacking MemMapping::backing() const {
+    return pageBacking;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// What backs the pages of a segment
+enum class PageBacking {
+    Normal,
+    // Transparent huge pages were asked for, the kernel may or may not use them
+    Transparent,
+    // 2 MiB pages: hugetlbfs on Linux, SEC_LARGE_PAGES on Windows
+    Huge,
+};
+
+const char* backingName(PageBacking backing);
+
+struct MapOptions {
+    // Falls back to normal pages when the OS has no huge pages to give, or for file-backed segments.
+    // Other processes find a huge page segment whatever they ask for, and abort if they cannot map it.
+    bool hugePages = false;
+    // Faults the whole segment in up front, so no first write after a restart waits for the kernel
+    bool prefault = false;
+};
+
+// Opens a named shared segment, creating it with the given size if it does not exist yet.
+// An existing segment is mapped at its own size, which is what size() reports.
+// With a path the segment is that file and outlives reboots, an existing non-empty file
+// counts as an existing segment. The segment is locked in memory as far as the OS limits allow.
+class MemMapping {
+public:
+    MemMapping(const std::wstring& name, size_t size, const std::string& path = "", const MapOptions& options = {});
+    ~MemMapping();
+
+    MemMapping(const MemMapping&) = delete;
+    MemMapping& operator=(const MemMapping&) = delete;
+
+    template<typename T>
+    T* data() {
+        return (T*)mapView;
+    }
+
+    size_t size() const;
+    bool created() const;
+    PageBacking backing() const;
+
+    // Starts writing dirty pages back to the file, or waits for that. Nothing to do without a file.
+    void flush(bool wait);
+
+    static void remove(const std::wstring& name);
+
+private:
+    void* mapView;
+    size_t mapSize;
+    bool isCreated;
+    bool isFile;
+    PageBacking pageBacking;
+#ifdef _WIN32
+    HANDLE mapFile;
+    HANDLE file;
+#endif
+};
@@ -0,0 +1,37 @@
+#include "Options.h"
+
+#include "platform.h"
+
+#include <cstdlib>
+
+Options::Options(int argc, char* argv[], int first) {
+    for (int i = first; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            continue;
+        }
+        std::string name = arg.substr(2);
+        if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0) {
+            values[name] = argv[++i];
+        } else {
+            values[name] = "1";
+        }
+    }
+}
+
+bool Options::has(const std::string& name) const {
+    return values.count(name) > 0;
+}
+
+std::string Options::get(const std::string& name, const std::string& defaultValue) const {
+    auto it = values.find(name);
+    return it == values.end() ? defaultValue : it->second;
+}
+
+int Options::getInt(const std::string& name, int defaultValue) const {
+    return has(name) ? std::atoi(get(name).c_str()) : defaultValue;
+}
+
+int Options::getSize(const std::string& name, int defaultValue) const {
+    return has(name) ? parseSize(get(name)) : defaultValue;
+}
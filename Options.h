@@ -0,0 +1,19 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+// "--name value" pairs following the positional arguments, a bare "--flag" is "1"
+class Options {
+public:
+    Options(int argc, char* argv[], int first);
+
+    bool has(const std::string& name) const;
+    std::string get(const std::string& name, const std::string& defaultValue = "") const;
+    int getInt(const std::string& name, int defaultValue) const;
+    // Accepts k/M suffixes, see parseSize
+    int getSize(const std::string& name, int defaultValue) const;
+
+private:
+    std::map<std::string, std::string> values;
+};
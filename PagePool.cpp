@@ -0,0 +1,836 @@
+#include "PagePool.h"
+
+#include "affinity.h"
+#include "checksum.h"
+#include "platform.h"
+
+#include <utility>
+#include <climits>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+
+PageLease::PageLease(PageLease&& other) noexcept
+    : pool(std::exchange(other.pool, nullptr))
+    , page(std::exchange(other.page, -1))
+    , lease(other.lease)
+    , isChit(other.isChit)
+{}
+
+PageLease& PageLease::operator=(PageLease&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool = std::exchange(other.pool, nullptr);
+        page = std::exchange(other.page, -1);
+        lease = other.lease;
+        isChit = other.isChit;
+    }
+    return *this;
+}
+
+PageLease::~PageLease() {
+    release();
+}
+
+PageLease::operator bool() const {
+    return pool != nullptr;
+}
+
+int PageLease::index() const {
+    return page;
+}
+
+PageSpan PageLease::span() const {
+    return pool->page(page);
+}
+
+uint64_t PageLease::sequence() const {
+    return pool->sequence(page);
+}
+
+uint64_t PageLease::release() {
+    if (!pool) {
+        return 0;
+    }
+    uint64_t sequence = pool->release(page, lease, isChit);
+    pool = nullptr;
+    page = -1;
+    return sequence;
+}
+
+PageLease::PageLease(PagePool* pool, int page, uint32_t lease, bool isChit)
+    : pool(pool)
+    , page(page)
+    , lease(lease)
+    , isChit(isChit)
+{}
+
+PageBatch::PageBatch(PageBatch&& other) noexcept
+    : pool(std::exchange(other.pool, nullptr))
+    , pages(std::move(other.pages))
+    , lease(other.lease)
+    , isChit(other.isChit)
+{}
+
+PageBatch& PageBatch::operator=(PageBatch&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool = std::exchange(other.pool, nullptr);
+        pages = std::move(other.pages);
+        lease = other.lease;
+        isChit = other.isChit;
+    }
+    return *this;
+}
+
+PageBatch::~PageBatch() {
+    release();
+}
+
+int PageBatch::size() const {
+    return pages.size();
+}
+
+int PageBatch::index(int i) const {
+    return pages[i];
+}
+
+PageSpan PageBatch::span(int i) const {
+    return pool->page(pages[i]);
+}
+
+uint64_t PageBatch::sequence(int i) const {
+    return pool->sequence(pages[i]);
+}
+
+uint64_t PageBatch::release() {
+    if (!pool) {
+        return 0;
+    }
+    uint64_t sequence = pool->release(pages, lease, isChit);
+    pool = nullptr;
+    pages.clear();
+    return sequence;
+}
+
+PageBatch::PageBatch(PagePool* pool, std::vector<int> pages, uint32_t lease, bool isChit)
+    : pool(pool)
+    , pages(std::move(pages))
+    , lease(lease)
+    , isChit(isChit)
+{}
+
+// Shared by the PagePool objects of a process, the handles are only opened once
+struct PoolMapping {
+    PoolMapping(const PoolGeometry& geometry, const std::wstring& channel, const PoolFile& file, const MapOptions& memory);
+    ~PoolMapping();
+
+    MemMapping mapShared;
+    SharedObject shared;
+    bool isValid;
+    PoolGeometry geometry;
+    MemMapping mapPages;
+    EventCount pagesToWriteEvent;
+    EventCount pagesToReadEvent;
+    EventCount assemblyEvent;
+    int processSlot;
+    bool persistent;
+    uint64_t flushInterval;
+    std::atomic<uint64_t> lastFlush;
+    // Readiness descriptors, opened on the first pollHandle or signal; writers' side first
+    std::wstring channel;
+    std::mutex pollLock;
+    std::unique_ptr<PollEvent> pollEvents[2];
+    bool polling[2];
+
+    PollEvent& pollEvent(bool isChit);
+};
+
+PoolMapping::PoolMapping(const PoolGeometry& geometry, const std::wstring& channel, const PoolFile& file, const MapOptions& memory)
+    : mapShared(PagePool::objectName(channel, L"MapShared"), SharedObject::bytes(geometry.normalized()),
+                file.path.empty() ? "" : file.path + ".ctl", MapOptions{false, memory.prefault})
+    , shared(mapShared.data<void>())
+    , isValid(shared.init(mapShared.created(), geometry.normalized()))
+    , geometry(isValid ? shared.geometry() : PoolGeometry{})
+    , mapPages(PagePool::objectName(channel, L"MapPages"), SharedObject::pagesBytes(this->geometry),
+               file.path.empty() ? "" : file.path + ".pages", memory)
+    , pagesToWriteEvent(shared.pageEvent(false), PagePool::objectName(channel, L"PagesToWriteEvent"))
+    , pagesToReadEvent(shared.pageEvent(true), PagePool::objectName(channel, L"PagesToReadEvent"))
+    , assemblyEvent(shared.assemblyEvent(), PagePool::objectName(channel, L"RecordAssemblyEvent"))
+    , processSlot(-1)
+    , persistent(!file.path.empty())
+    , flushInterval(std::max(0, file.flushIntervalMs))
+    , lastFlush(0)
+    , channel(channel)
+    , polling{false, false}
+{
+    if (isValid) {
+        shared.attachPages(mapPages.data<void>());
+        processSlot = shared.attachProcess();
+    }
+}
+
+PoolMapping::~PoolMapping() {
+    for (int side = 0; side < 2; ++side) {
+        if (polling[side]) {
+            shared.stopPolling(side == 1);
+        }
+    }
+    if (persistent) {
+        mapPages.flush(false);
+        mapShared.flush(false);
+    }
+}
+
+PollEvent& PoolMapping::pollEvent(bool isChit) {
+    std::lock_guard<std::mutex> lock(pollLock);
+    std::unique_ptr<PollEvent>& event = pollEvents[isChit];
+    if (!event) {
+        event = std::make_unique<PollEvent>(PagePool::objectName(channel, isChit ? L"PagesToReadPoll" : L"PagesToWritePoll"));
+    }
+    return *event;
+}
+
+PagePool::PagePool(const PoolGeometry& geometry, const std::wstring& channel, const PoolFile& file, const MapOptions& memory)
+    : PagePool(open(geometry, channel, file, memory))
+{}
+
+PagePool::PagePool(std::shared_ptr<PoolMapping> mapping)
+    : poolMapping(std::move(mapping))
+    , shared(poolMapping->shared)
+    , poolGeometry(poolMapping->geometry)
+    , pagesToWriteEvent(poolMapping->pagesToWriteEvent)
+    , pagesToReadEvent(poolMapping->pagesToReadEvent)
+    , assemblyEvent(poolMapping->assemblyEvent)
+    , readerSlot(-1)
+    , readNext(0)
+    , writerSlot(-1)
+    , queueSlot(-1)
+    , lastSequence(-1)
+{
+    if (poolMapping->isValid) {
+        reclaim();
+    }
+}
+
+PagePool::~PagePool() {
+    if (readerSlot >= 0) {
+        shared.unsubscribe(readerSlot);
+        // Writers may be gated on us
+        pagesToWriteEvent.notify(INT_MAX);
+        signalPoll(false);
+    }
+    if (writerSlot >= 0) {
+        shared.detachWriter(writerSlot);
+    }
+    if (queueSlot >= 0) {
+        shared.leaveQueue(queueSlot);
+    }
+}
+
+std::shared_ptr<PoolMapping> PagePool::open(const PoolGeometry& geometry, const std::wstring& channel, const PoolFile& file, const MapOptions& memory) {
+    return std::make_shared<PoolMapping>(geometry, channel, file, memory);
+}
+
+const std::shared_ptr<PoolMapping>& PagePool::mapping() const {
+    return poolMapping;
+}
+
+PageBacking PagePool::backing() const {
+    return poolMapping->mapPages.backing();
+}
+
+bool PagePool::valid() const {
+    return poolMapping->isValid;
+}
+
+const PoolGeometry& PagePool::geometry() const {
+    return poolGeometry;
+}
+
+PageLease PagePool::lease(bool isChit) {
+    uint32_t number = 0;
+    int page = acquire(isChit, number);
+    if (page < 0) {
+        return {};
+    }
+    return {this, page, number, isChit};
+}
+
+PageBatch PagePool::batch(bool isChit, int maxCount) {
+    uint32_t number = 0;
+    std::vector<int> pages = acquire(isChit, maxCount, number);
+    return {this, std::move(pages), number, isChit};
+}
+
+PageAwaiter PagePool::acquireWrite(int maxCount) {
+    return {this, false, maxCount};
+}
+
+PageAwaiter PagePool::acquireRead(int maxCount) {
+    return {this, true, maxCount};
+}
+
+bool PagePool::inLine(bool isChit) const {
+    // Broadcast readers each have a cursor of their own, there is no line to stand in
+    return poolGeometry.fairness == Fairness::Fifo && !(isBroadcast() && isChit);
+}
+
+template<typename F>
+bool PagePool::takeInTurn(bool isChit, uint64_t ticket, F tryTake) {
+    if (!shared.isTurn(isChit, ticket) || !tryTake()) {
+        return false;
+    }
+    shared.passTurn(isChit, ticket);
+    // The next in line may be parked behind others
+    inputEvent(isChit).notify(INT_MAX);
+    return true;
+}
+
+PageAwaiter::PageAwaiter(PagePool* pool, bool isChit, int maxCount)
+    : pool(pool)
+    , isChit(isChit)
+    , maxCount(std::max(1, maxCount))
+    , pages(this->maxCount)
+    , lease(0)
+    , started(false)
+    , allowed(0)
+    , ticket(-1)
+{
+    priority = pool->preferred(isChit) ? 1 : 0;
+}
+
+PageAwaiter::~PageAwaiter() {
+    if (ticket >= 0) {
+        pool->shared.leaveLine(isChit, ticket);
+        pool->inputEvent(isChit).notify(INT_MAX);
+    }
+    if (allowed > 0 && !isChit) {
+        pool->refundBudget(allowed);
+    }
+}
+
+bool PageAwaiter::ready() {
+    SharedObject& shared = pool->shared;
+    if (!started) {
+        started = true;
+        start = std::chrono::steady_clock::now();
+        shared.heartbeat(pool->poolMapping->processSlot);
+        if (pool->isBroadcast() && isChit && !pool->subscribe()) {
+            // No cursor to read with, resume with an empty batch
+            pages.clear();
+            return true;
+        }
+    }
+    if (allowed == 0) {
+        uint64_t waitMs = 0;
+        allowed = isChit ? maxCount : pool->tryBudget(maxCount, waitMs);
+        if (allowed == 0) {
+            event = nullptr;
+            deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(waitMs);
+            return false;
+        }
+    }
+    event = &pool->inputEvent(isChit);
+    deadline = EventLoop::Clock::time_point::max();
+    if (ticket < 0 && pool->inLine(isChit)) {
+        ticket = (int64_t)shared.takeTicket(isChit);
+    }
+    int count = 0;
+    auto take = [&]() {
+        count = pool->tryTake(isChit, pages.data(), allowed, lease);
+        return count > 0;
+    };
+    if (!(ticket >= 0 ? pool->takeInTurn(isChit, (uint64_t)ticket, take) : take())) {
+        return false;
+    }
+    ticket = -1;
+    if (!isChit) {
+        pool->refundBudget(allowed - count);
+    }
+    allowed = 0;
+    pages.resize(count);
+    pool->countWait(isChit, start);
+    if (isChit) {
+        pool->verify(pages.data(), count);
+    }
+    return true;
+}
+
+bool PageAwaiter::await_ready() {
+    // Always through the loop, a task that could go on taking pages would starve the others
+    return false;
+}
+
+PageBatch PageAwaiter::await_resume() {
+    return {pool, std::move(pages), lease, isChit};
+}
+
+template<typename F>
+void PagePool::waitForPages(bool isChit, F tryTake) {
+    auto start = std::chrono::steady_clock::now();
+    EventCount& event = inputEvent(isChit);
+    if (inLine(isChit)) {
+        uint64_t ticket = shared.takeTicket(isChit);
+        waitFor(event, [&]() {
+            return takeInTurn(isChit, ticket, tryTake);
+        });
+    } else if (poolGeometry.fairness == Fairness::ReaderPriority || poolGeometry.fairness == Fairness::WriterPriority) {
+        static const int SPIN_COUNT = spinCount();
+        waitFor(event, tryTake, preferred(isChit) ? SPIN_COUNT * 8 : 0);
+    } else {
+        waitFor(event, tryTake);
+    }
+    countWait(isChit, start);
+}
+
+bool PagePool::preferred(bool isChit) const {
+    return poolGeometry.fairness == (isChit ? Fairness::ReaderPriority : Fairness::WriterPriority);
+}
+
+void PagePool::countWait(bool isChit, std::chrono::steady_clock::time_point start) {
+    auto waited = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    WaitStats& stats = isChit ? readerWaits : writerWaits;
+    ++stats.acquires;
+    stats.totalNs += waited;
+    stats.maxNs = std::max(stats.maxNs, waited);
+}
+
+void PagePool::wake(EventCount& event, int count) {
+    event.notify(poolGeometry.fairness == Fairness::Fifo ? INT_MAX : count);
+}
+
+void PagePool::signalPoll(bool isChit, uint64_t position) {
+    if (shared.pollSignalDue(isChit, position)) {
+        poolMapping->pollEvent(isChit).signal();
+    }
+}
+
+PollDescriptor PagePool::pollHandle(bool isChit) {
+    PollEvent& event = poolMapping->pollEvent(isChit);
+    {
+        std::lock_guard<std::mutex> lock(poolMapping->pollLock);
+        if (!poolMapping->polling[isChit]) {
+            poolMapping->polling[isChit] = true;
+            shared.startPolling(isChit);
+            // Pages released before we registered signaled nobody
+            if (shared.pollSignalDue(isChit)) {
+                event.signal();
+            }
+        }
+    }
+    if (isBroadcast() && isChit) {
+        subscribe();
+    }
+    return event.descriptor();
+}
+
+void PagePool::pollReset(bool isChit) {
+    poolMapping->pollEvent(isChit).reset();
+    shared.disarmPoll(isChit);
+}
+
+PageBatch PagePool::tryBatch(bool isChit, int maxCount) {
+    shared.heartbeat(poolMapping->processSlot);
+    std::vector<int> pages(maxCount);
+    int allowed = maxCount;
+    if (!isChit) {
+        uint64_t waitMs = 0;
+        allowed = tryBudget(maxCount, waitMs);
+    }
+    if (isBroadcast() && isChit && !subscribe()) {
+        return {this, {}, 0, isChit};
+    }
+    uint32_t lease = 0;
+    int count = allowed > 0 ? tryTake(isChit, pages.data(), allowed, lease) : 0;
+    if (!isChit) {
+        refundBudget(allowed - count);
+    }
+    pages.resize(count);
+    if (isChit) {
+        verify(pages.data(), count);
+    }
+    return {this, std::move(pages), lease, isChit};
+}
+
+int PagePool::acquire(bool isChit, uint32_t& lease) {
+    if (isBroadcast()) {
+        std::vector<int> pages = acquire(isChit, 1, lease);
+        return pages.empty() ? -1 : pages[0];
+    }
+    if (!isChit) {
+        takeBudget(1);
+    }
+    int page = takePage(isChit, lease);
+    if (isChit) {
+        verify(&page, 1);
+    }
+    return page;
+}
+
+int PagePool::takePage(bool isChit, uint32_t& lease) {
+    shared.heartbeat(poolMapping->processSlot);
+    int page = -1;
+    waitForPages(isChit, [&]() {
+        return shared.takePages(isChit, &page, 1, lease, queueFor(isChit)) > 0;
+    });
+    return page;
+}
+
+int PagePool::queueFor(bool isChit) {
+    if (isChit && queueSlot < 0 && poolGeometry.stealing) {
+        queueSlot = shared.joinQueue();
+    }
+    return isChit ? queueSlot : -1;
+}
+
+uint64_t PagePool::release(int page, uint32_t lease, bool isChit) {
+    if (isBroadcast() || shared.pageMeta(page).next >= 0) {
+        return release(std::vector<int>{page}, lease, isChit);
+    }
+    if (!isChit) {
+        seal(&page, 1);
+    }
+    if (isChit && poolGeometry.budgets) {
+        shared.countDrained(1);
+    }
+    uint64_t position = shared.returnPages(&page, 1, isChit, lease);
+    wake(outputEvent(isChit), 1);
+    signalPoll(!isChit, position);
+    flushIfDue();
+    return position;
+}
+
+std::vector<int> PagePool::acquire(bool isChit, int maxCount, uint32_t& lease) {
+    if (isBroadcast() && isChit && !subscribe()) {
+        return {};
+    }
+    shared.heartbeat(poolMapping->processSlot);
+    std::vector<int> pages(maxCount);
+    int count = 0;
+    int allowed = isChit ? maxCount : takeBudget(maxCount);
+    waitForPages(isChit, [&]() {
+        count = tryTake(isChit, pages.data(), allowed, lease);
+        return count > 0;
+    });
+    if (!isChit) {
+        refundBudget(allowed - count);
+    }
+    pages.resize(count);
+    if (isChit) {
+        verify(pages.data(), count);
+    }
+    return pages;
+}
+
+uint64_t PagePool::release(const std::vector<int>& pages, uint32_t lease, bool isChit) {
+    if (pages.empty()) {
+        return 0;
+    }
+    if (!isChit && poolGeometry.checksums) {
+        std::vector<int> chains = withChains(pages);
+        seal(chains.data(), chains.size());
+    }
+    if (isBroadcast()) {
+        // Readers hand pages back in the order they got them
+        if (isChit) {
+            shared.advanceCursor(readerSlot, shared.pageSequence(pages.back()) + 1);
+            wake(outputEvent(isChit), pages.size());
+            signalPoll(false);
+            return 0;
+        }
+        shared.publishSlots(pages.data(), pages.size(), lease);
+        // Every reader wants every page
+        outputEvent(isChit).notify(INT_MAX);
+        signalPoll(true);
+        flushIfDue();
+        return shared.pageSequence(pages.front());
+    }
+    if (isChit) {
+        std::vector<int> chains = withChains(pages);
+        if (poolGeometry.budgets) {
+            shared.countDrained(chains.size());
+        }
+        uint64_t position = shared.returnPages(chains.data(), chains.size(), isChit, lease);
+        wake(outputEvent(isChit), chains.size());
+        signalPoll(false, position);
+        flushIfDue();
+        return 0;
+    }
+    uint64_t position = shared.returnPages(pages.data(), pages.size(), isChit, lease);
+    wake(outputEvent(isChit), pages.size());
+    signalPoll(true, position);
+    flushIfDue();
+    return position;
+}
+
+std::vector<int> PagePool::withChains(const std::vector<int>& heads) {
+    std::vector<int> result;
+    for (int page : heads) {
+        for (; page >= 0; page = shared.pageMeta(page).next) {
+            result.push_back(page);
+        }
+    }
+    return result;
+}
+
+bool PagePool::placeOnNode(int node) {
+    MemMapping& mapPages = poolMapping->mapPages;
+    return ::placeOnNode(mapPages.data<void>(), mapPages.size(), node);
+}
+
+std::vector<int> PagePool::pageNodes() {
+    MemMapping& mapPages = poolMapping->mapPages;
+    return ::pageNodes(mapPages.data<void>(), mapPages.size());
+}
+
+int PagePool::reclaim(int staleMs) {
+    Reclaimed reclaimed = shared.reclaim(staleMs);
+    if (reclaimed.freePages > 0) {
+        wake(pagesToWriteEvent, reclaimed.freePages);
+    }
+    if (reclaimed.publishedPages > 0) {
+        pagesToReadEvent.notify(INT_MAX);
+    }
+    if (reclaimed.readers > 0) {
+        // Writers gated on a dead reader can move on
+        pagesToWriteEvent.notify(INT_MAX);
+    }
+    if (reclaimed.turns > 0) {
+        pagesToWriteEvent.notify(INT_MAX);
+        pagesToReadEvent.notify(INT_MAX);
+    }
+    if (reclaimed.assembly) {
+        assemblyEvent.notify();
+    }
+    if (reclaimed.freePages > 0 || reclaimed.readers > 0) {
+        signalPoll(false);
+    }
+    if (reclaimed.publishedPages > 0) {
+        signalPoll(true);
+    }
+    return reclaimed.total();
+}
+
+bool PagePool::publish(const void* data, size_t size) {
+    if (poolGeometry.snapshotSize == 0 || size > (size_t)poolGeometry.snapshotSize) {
+        return false;
+    }
+    shared.publishSnapshot(data, (uint32_t)size);
+    ++snapshotStats.published;
+    return true;
+}
+
+uint64_t PagePool::latest(void* data, size_t capacity, size_t& size) {
+    if (poolGeometry.snapshotSize == 0) {
+        size = 0;
+        return 0;
+    }
+    uint32_t length = 0;
+    uint64_t version = shared.readSnapshot(data, (uint32_t)std::min(capacity, (size_t)poolGeometry.snapshotSize), length, snapshotStats.retries);
+    ++snapshotStats.reads;
+    size = length;
+    return version;
+}
+
+uint64_t PagePool::snapshotVersion() const {
+    return shared.snapshotVersion();
+}
+
+const WaitStats& PagePool::waitStats(bool isChit) const {
+    return isChit ? readerWaits : writerWaits;
+}
+
+const IntegrityStats& PagePool::integrity() const {
+    return integrityStats;
+}
+
+const CompressionStats& PagePool::compression() const {
+    return compressionStats;
+}
+
+const SnapshotStats& PagePool::snapshots() const {
+    return snapshotStats;
+}
+
+void PagePool::seal(const int* pages, int count) {
+    if (!poolGeometry.checksums) {
+        return;
+    }
+    for (int k = 0; k < count; ++k) {
+        PageMeta& meta = shared.pageMeta(pages[k]);
+        meta.checksum = crc32c(shared.payload(pages[k]), meta.length);
+    }
+}
+
+void PagePool::verify(const int* pages, int count) {
+    if (!poolGeometry.checksums) {
+        return;
+    }
+    for (int k = 0; k < count; ++k) {
+        auto sequence = (int64_t)shared.pageSequence(pages[k]);
+        if (lastSequence >= 0) {
+            if (sequence <= lastSequence && !poolGeometry.stealing) {
+                ++integrityStats.reordered;
+            } else if (isBroadcast() && sequence > lastSequence + 1) {
+                integrityStats.lost += sequence - lastSequence - 1;
+            }
+        }
+        lastSequence = std::max(lastSequence, sequence);
+        for (int page = pages[k]; page >= 0; page = shared.pageMeta(page).next) {
+            const PageMeta& meta = shared.pageMeta(page);
+            ++integrityStats.verified;
+            if (meta.length > (uint32_t)poolGeometry.pageSize || crc32c(shared.payload(page), meta.length) != meta.checksum) {
+                ++integrityStats.corrupted;
+            }
+        }
+    }
+}
+
+void PagePool::heartbeat() {
+    shared.heartbeat(poolMapping->processSlot);
+}
+
+void PagePool::flush() {
+    if (poolMapping->persistent) {
+        poolMapping->mapPages.flush(true);
+        poolMapping->mapShared.flush(true);
+        poolMapping->lastFlush = monotonicMs();
+    }
+}
+
+void PagePool::flushIfDue() {
+    PoolMapping& mapping = *poolMapping;
+    if (!mapping.persistent) {
+        return;
+    }
+    uint64_t now = monotonicMs();
+    uint64_t last = mapping.lastFlush.load(std::memory_order_relaxed);
+    // One worker of the process starts the write-back, the rest carry on
+    if (now - last < mapping.flushInterval || !mapping.lastFlush.compare_exchange_strong(last, now)) {
+        return;
+    }
+    // The rings live in the control block, it has to go along with the payloads
+    mapping.mapPages.flush(false);
+    mapping.mapShared.flush(false);
+}
+
+bool PagePool::overBudget() {
+    if (!poolGeometry.budgets) {
+        return false;
+    }
+    if (writerSlot < 0) {
+        writerSlot = shared.attachWriter();
+    }
+    return writerSlot >= 0 && shared.overBudget(writerSlot);
+}
+
+const WriterBucket* PagePool::writerBudget() const {
+    return writerSlot >= 0 ? &shared.writerBucket(writerSlot) : nullptr;
+}
+
+int PagePool::tryTake(bool isChit, int* pages, int maxCount, uint32_t& lease) {
+    if (!isBroadcast()) {
+        return shared.takePages(isChit, pages, maxCount, lease, queueFor(isChit));
+    }
+    if (!isChit) {
+        return shared.claimSlots(pages, maxCount, lease);
+    }
+    // Broadcast readers only move their cursor, nothing is leased
+    lease = 0;
+    int count = shared.readSlots(readNext, pages, maxCount);
+    readNext += count;
+    return count;
+}
+
+int PagePool::takeBudget(int maxCount) {
+    while (true) {
+        uint64_t waitMs = 0;
+        int count = tryBudget(maxCount, waitMs);
+        if (count > 0) {
+            return count;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
+    }
+}
+
+int PagePool::tryBudget(int maxCount, uint64_t& waitMs) {
+    if (!poolGeometry.budgets) {
+        return maxCount;
+    }
+    if (writerSlot < 0) {
+        writerSlot = shared.attachWriter();
+    }
+    if (writerSlot < 0) {
+        // Every bucket is taken, this writer goes unthrottled
+        return maxCount;
+    }
+    return shared.takeTokens(writerSlot, maxCount, waitMs);
+}
+
+void PagePool::chargeBudget(int count) {
+    if (writerSlot >= 0) {
+        shared.chargeTokens(writerSlot, count);
+    }
+}
+
+void PagePool::refundBudget(int count) {
+    if (writerSlot >= 0 && count > 0) {
+        shared.refundTokens(writerSlot, count);
+    }
+}
+
+bool PagePool::subscribe() {
+    if (readerSlot < 0) {
+        readerSlot = shared.subscribe();
+        readNext = readerSlot >= 0 ? shared.readerNext(readerSlot) : 0;
+    }
+    return readerSlot >= 0;
+}
+
+bool PagePool::isBroadcast() const {
+    return poolGeometry.mode == PoolMode::Broadcast;
+}
+
+uint64_t PagePool::sequence(int page) {
+    return shared.pageSequence(page);
+}
+
+PageSpan PagePool::page(int idx) {
+    return {shared.payload(idx), (size_t)poolGeometry.pageSize};
+}
+
+void PagePool::remove(const std::wstring& channel) {
+    EventCount::remove(objectName(channel, L"PagesToWriteEvent"));
+    EventCount::remove(objectName(channel, L"PagesToReadEvent"));
+    EventCount::remove(objectName(channel, L"RecordAssemblyEvent"));
+    MemMapping::remove(objectName(channel, L"MapShared"));
+    MemMapping::remove(objectName(channel, L"MapPages"));
+    PollEvent::remove(objectName(channel, L"PagesToWritePoll"));
+    PollEvent::remove(objectName(channel, L"PagesToReadPoll"));
+}
+
+bool PagePool::validChannel(const std::wstring& channel) {
+    for (wchar_t c : channel) {
+        bool letter = (c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z');
+        bool digit = c >= L'0' && c <= L'9';
+        if (!letter && !digit && c != L'-' && c != L'_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::wstring PagePool::objectName(const std::wstring& channel, const wchar_t* name) {
+    return channel.empty() ? name : channel + L"_" + name;
+}
+
+EventCount& PagePool::inputEvent(bool isChit) {
+    return isChit ? pagesToReadEvent : pagesToWriteEvent;
+}
+
+EventCount& PagePool::outputEvent(bool isChit) {
+    return isChit ? pagesToWriteEvent : pagesToReadEvent;
+}
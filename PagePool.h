@@ -0,0 +1,333 @@
+#pragma once
+
+#include "MemMapping.h"
+#include "EventCount.h"
+#include "EventLoop.h"
+#include "SharedObject.h"
+#include "PollEvent.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+
+// Mapped page memory, no copies involved
+struct PageSpan {
+    char* data;
+    size_t size;
+
+    char* begin() const { return data; }
+    char* end() const { return data + size; }
+};
+
+class PagePool;
+
+// The mappings and kernel objects of one pool. Every worker of a process can share a single one.
+struct PoolMapping;
+
+// Time workers spent in acquire, waiting for pages and for their turn
+struct WaitStats {
+    uint64_t acquires = 0;
+    uint64_t totalNs = 0;
+    uint64_t maxNs = 0;
+};
+
+// What readers of a pool with checksums found. Lost pages only show up in broadcast mode,
+// a queue reader never sees every sequence number.
+struct IntegrityStats {
+    uint64_t verified = 0;
+    // Payload does not match the checksum its writer sealed it with
+    uint64_t corrupted = 0;
+    // Sequence number not above the previous one, not counted in work-stealing pools
+    uint64_t reordered = 0;
+    uint64_t lost = 0;
+};
+
+// Pages written by the RecordWriters of a pool object, ratios are raw over stored bytes
+struct CompressionStats {
+    // Stored as is, because compressing did not save enough
+    uint64_t bypassed = 0;
+    uint64_t compressed = 0;
+    uint64_t rawBytes = 0;
+    uint64_t storedBytes = 0;
+    // Compressed pages by ratio: below 2, below 4, below 8, 8 and up
+    uint64_t ratios[4] = {};
+};
+
+// Latest-value traffic of a pool object
+struct SnapshotStats {
+    uint64_t published = 0;
+    uint64_t reads = 0;
+    // Copies thrown away because a writer got in between
+    uint64_t retries = 0;
+};
+
+// Backing files for a persistent pool, "<path>.ctl" and "<path>.pages". An empty path keeps
+// the pool in memory only. Pools persisted by an earlier run are picked up as they were left,
+// except that after a reboot whatever the old processes held is free again.
+struct PoolFile {
+    std::string path;
+    // Commits start an asynchronous write-back at most this often, zero does it on every commit
+    int flushIntervalMs = 100;
+};
+
+// A page taken from the pool, handed back when the lease goes out of scope.
+// Writers produce straight into span(), readers consume straight from it.
+class PageLease {
+public:
+    PageLease() = default;
+    PageLease(PageLease&& other) noexcept;
+    PageLease& operator=(PageLease&& other) noexcept;
+    ~PageLease();
+
+    explicit operator bool() const;
+
+    int index() const;
+    PageSpan span() const;
+    // Commit sequence number, for readers
+    uint64_t sequence() const;
+
+    // Returns the page early, for writers the result is the commit sequence number
+    uint64_t release();
+
+private:
+    friend class PagePool;
+    PageLease(PagePool* pool, int page, uint32_t lease, bool isChit);
+
+    PagePool* pool = nullptr;
+    int page = -1;
+    uint32_t lease = 0;
+    bool isChit = false;
+};
+
+// Several pages taken in one claim and handed back in one release
+class PageBatch {
+public:
+    PageBatch() = default;
+    PageBatch(PageBatch&& other) noexcept;
+    PageBatch& operator=(PageBatch&& other) noexcept;
+    ~PageBatch();
+
+    int size() const;
+    int index(int i) const;
+    PageSpan span(int i) const;
+    // Commit sequence number, for readers
+    uint64_t sequence(int i) const;
+
+    // Returns all pages early, for writers the result is the commit sequence of the first one
+    uint64_t release();
+
+private:
+    friend class PagePool;
+    friend class PageAwaiter;
+    PageBatch(PagePool* pool, std::vector<int> pages, uint32_t lease, bool isChit);
+
+    PagePool* pool = nullptr;
+    std::vector<int> pages;
+    uint32_t lease = 0;
+    bool isChit = false;
+};
+
+// co_await pool.acquireWrite() in a task of an EventLoop: a batch like PagePool::batch, but the task
+// is parked on the loop instead of blocking its thread. Budgets, Fifo turns and priorities are kept as well.
+class PageAwaiter : public EventLoop::Waiter {
+public:
+    // A task destroyed while in line for a Fifo turn leaves the line
+    ~PageAwaiter();
+
+    PageAwaiter(const PageAwaiter&) = delete;
+    PageAwaiter& operator=(const PageAwaiter&) = delete;
+
+    bool ready() override;
+
+    bool await_ready();
+    template<typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> handle) {
+        handle.promise().loop->suspend(*this, handle);
+    }
+    PageBatch await_resume();
+
+private:
+    friend class PagePool;
+    PageAwaiter(PagePool* pool, bool isChit, int maxCount);
+
+    PagePool* pool;
+    bool isChit;
+    int maxCount;
+    std::vector<int> pages;
+    uint32_t lease;
+    bool started;
+    std::chrono::steady_clock::time_point start;
+    // Budget tokens already taken, Fifo ticket while in line
+    int allowed;
+    int64_t ticket;
+};
+
+class PagePool {
+public:
+    // The geometry is only a request, a pool that already exists keeps its own.
+    // Pools on different channels share nothing, the default channel is the unprefixed one.
+    // Huge pages in the memory options only back the pages, the control block is too small for them.
+    explicit PagePool(const PoolGeometry& geometry = {}, const std::wstring& channel = L"", const PoolFile& file = {}, const MapOptions& memory = {});
+    // Another worker on an open pool: leases, cursors and statistics of its own, nothing mapped again
+    explicit PagePool(std::shared_ptr<PoolMapping> mapping);
+    ~PagePool();
+
+    // Maps the pool, or attaches to it if it exists, for PagePool objects to share
+    static std::shared_ptr<PoolMapping> open(const PoolGeometry& geometry = {}, const std::wstring& channel = L"", const PoolFile& file = {}, const MapOptions& memory = {});
+    const std::shared_ptr<PoolMapping>& mapping() const;
+    // What the pages ended up on, huge pages may have been asked for and not given
+    PageBacking backing() const;
+
+    PagePool(const PagePool&) = delete;
+    PagePool& operator=(const PagePool&) = delete;
+
+    // False when the shared mapping was created by an incompatible version
+    bool valid() const;
+    const PoolGeometry& geometry() const;
+
+    // Empty for a broadcast reader that could not subscribe, see subscribe
+    PageLease lease(bool isChit);
+    // Waits for at least one page, then claims every available one up to maxCount at once.
+    // Empty for a broadcast reader that could not subscribe.
+    PageBatch batch(bool isChit, int maxCount);
+    // The same for tasks of an EventLoop, see PageAwaiter
+    PageAwaiter acquireWrite(int maxCount = 1);
+    PageAwaiter acquireRead(int maxCount = 1);
+
+    // Commit sequence number of a page taken for reading
+    uint64_t sequence(int page);
+
+    PageSpan page(int idx);
+
+    // Puts the page payloads on a NUMA node, see placeOnNode
+    bool placeOnNode(int node);
+    // Node of every OS page backing the payloads, -1 where nothing is resident yet
+    std::vector<int> pageNodes();
+
+    // Broadcast readers get a cursor on their first read, subscribing early makes sure
+    // nothing published in between is missed. False when all cursor slots are taken.
+    bool subscribe();
+
+    // Gives back what dead processes held: their pages, broadcast cursors, the record
+    // assembly lock and a latest-value update they were in the middle of. Runs on construction too. With staleMs above zero pages leased longer ago
+    // by a process without a heartbeat for as long are taken as well. Returns how much was reclaimed.
+    int reclaim(int staleMs = 0);
+    // Every acquire beats already, long holders call this to keep their pages
+    void heartbeat();
+
+    // Waits until everything committed so far is on disk, for persistent pools
+    void flush();
+
+    // In pools with budgets writers get pages at their share of the reader drain rate once the
+    // pool fills up, acquire waits for tokens as well. True when the next page would have to wait.
+    bool overBudget();
+    // This writer's bucket, null until it wrote with budgets on
+    const WriterBucket* writerBudget() const;
+
+    // Latest-value slot of pools with a snapshot size, for readers that only want the newest state
+    // and no pages. publish replaces the snapshot whole without waiting for any reader, false when
+    // the pool has no slot or the data does not fit.
+    bool publish(const void* data, size_t size);
+    // Copies the newest snapshot out, at most capacity bytes, and sets size to its full length.
+    // Never blocks a writer, a copy that a writer got in between is simply done again.
+    // Returns the number of the snapshot, zero while nothing was published yet.
+    uint64_t latest(void* data, size_t capacity, size_t& size);
+    // Number of the newest snapshot, for polling without copying
+    uint64_t snapshotVersion() const;
+
+    // Readiness for event loops of other kinds: a descriptor for epoll or WaitForMultipleObjects that
+    // turns readable when isChit pages become available, shared by every poller of that side on the
+    // channel. Releases only signal it when the side had nothing left, so a burst costs one wake-up.
+    // On a wake-up call pollReset first, then tryBatch until it comes back empty.
+    // Several polling processes on one side split the wake-ups, so broadcast readers should poll alone.
+    PollDescriptor pollHandle(bool isChit);
+    void pollReset(bool isChit);
+    // Whatever is available right now, possibly nothing. Never waits, Fifo lines included.
+    PageBatch tryBatch(bool isChit, int maxCount);
+
+    // Of this pool object, so per worker
+    const WaitStats& waitStats(bool isChit) const;
+    const IntegrityStats& integrity() const;
+    const CompressionStats& compression() const;
+    const SnapshotStats& snapshots() const;
+
+    // Drops the named objects left behind by previous runs, POSIX only
+    static void remove(const std::wstring& channel = L"");
+
+    // Channel names end up in kernel object names: ASCII letters, digits, '-' and '_'
+    static bool validChannel(const std::wstring& channel);
+
+private:
+    friend struct PoolMapping;
+    friend class PageLease;
+    friend class PageBatch;
+    friend class PageAwaiter;
+    friend class RecordWriter;
+    friend class RecordLease;
+
+    // What leases and batches are made of. Pages go back under the lease number they were taken with,
+    // see SharedObject::takePages. -1 or empty for a broadcast reader that could not subscribe.
+    int acquire(bool isChit, uint32_t& lease);
+    std::vector<int> acquire(bool isChit, int maxCount, uint32_t& lease);
+    // Writers get the global sequence number of the (first) page back
+    uint64_t release(int page, uint32_t lease, bool isChit);
+    // Commits the whole batch at consecutive sequence numbers and wakes up to that many waiters
+    uint64_t release(const std::vector<int>& pages, uint32_t lease, bool isChit);
+    // Readers hand back the head page of a record, the rest of its chain goes with it
+    std::vector<int> withChains(const std::vector<int>& heads);
+    bool isBroadcast() const;
+    // Batched write-back after commits, see PoolFile
+    void flushIfDue();
+    // One try at up to maxCount pages, without waiting
+    int tryTake(bool isChit, int* pages, int maxCount, uint32_t& lease);
+    // Waits until the budget allows at least one page, returns how many it allows
+    int takeBudget(int maxCount);
+    // Zero when over budget, then waitMs says when to try again
+    int tryBudget(int maxCount, uint64_t& waitMs);
+    void refundBudget(int count);
+    void chargeBudget(int count);
+    // Single page, the budget is up to the caller
+    int takePage(bool isChit, uint32_t& lease);
+    // Readers of work-stealing pools get a queue of their own on their first take
+    int queueFor(bool isChit);
+    // Checksums: writers seal what they commit, readers verify what they take, records page by page
+    void seal(const int* pages, int count);
+    void verify(const int* pages, int count);
+    // Waits under the pool's fairness policy and keeps the wait statistics
+    template<typename F>
+    void waitForPages(bool isChit, F tryTake);
+    // Whether waiters of the side stand in the Fifo line
+    bool inLine(bool isChit) const;
+    // Takes pages only on the ticket's turn, then passes the turn on. Shared by blocking waits and awaiters.
+    template<typename F>
+    bool takeInTurn(bool isChit, uint64_t ticket, F tryTake);
+    // The side a priority policy favors
+    bool preferred(bool isChit) const;
+    void countWait(bool isChit, std::chrono::steady_clock::time_point start);
+    // Fifo waiters only go on their turn, so releases have to wake all of them
+    void wake(EventCount& event, int count);
+    // Pollers of the side waiting on isChit pages, position is where the released pages went if known
+    void signalPoll(bool isChit, uint64_t position = SharedObject::NO_POSITION);
+    static std::wstring objectName(const std::wstring& channel, const wchar_t* name);
+
+    EventCount& inputEvent(bool isChit);
+    EventCount& outputEvent(bool isChit);
+
+    std::shared_ptr<PoolMapping> poolMapping;
+    SharedObject& shared;
+    const PoolGeometry& poolGeometry;
+    EventCount& pagesToWriteEvent;
+    EventCount& pagesToReadEvent;
+    EventCount& assemblyEvent;
+    int readerSlot;
+    uint64_t readNext;
+    int writerSlot;
+    int queueSlot;
+    WaitStats writerWaits;
+    WaitStats readerWaits;
+    IntegrityStats integrityStats;
+    CompressionStats compressionStats;
+    SnapshotStats snapshotStats;
+    int64_t lastSequence;
+};
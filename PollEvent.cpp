@@ -0,0 +1,79 @@
+#include "PollEvent.h"
+
+#include "platform.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef _WIN32
+
+PollEvent::PollEvent(const std::wstring& name)
+    : handle(CreateEventW(nullptr, TRUE, FALSE, name.c_str()))
+{}
+
+PollEvent::~PollEvent() {
+    if (handle) {
+        CloseHandle(handle);
+    }
+}
+
+void PollEvent::signal() {
+    SetEvent(handle);
+}
+
+void PollEvent::reset() {
+    ResetEvent(handle);
+}
+
+void PollEvent::remove(const std::wstring& name) {
+    // Events die with their last handle
+}
+
+#else
+
+namespace {
+
+std::string fifoPath(const std::wstring& name) {
+    return "/dev/shm" + posixName(name) + ".fifo";
+}
+
+}
+
+PollEvent::PollEvent(const std::wstring& name) {
+    std::string path = fifoPath(name);
+    mkfifo(path.c_str(), 0666);
+    // Read-write, so the FIFO never sees its last writer go and never reports end of file
+    handle = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+}
+
+PollEvent::~PollEvent() {
+    if (handle >= 0) {
+        close(handle);
+    }
+}
+
+void PollEvent::signal() {
+    // A full pipe is as signaled as it gets
+    char byte = 1;
+    (void)!write(handle, &byte, 1);
+}
+
+void PollEvent::reset() {
+    char bytes[64];
+    while (read(handle, bytes, sizeof(bytes)) > 0) {
+    }
+}
+
+void PollEvent::remove(const std::wstring& name) {
+    unlink(fifoPath(name).c_str());
+}
+
+#endif
+
+PollDescriptor PollEvent::descriptor() const {
+    return handle;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef _WIN32
+using PollDescriptor = HANDLE;
+#else
+using PollDescriptor = int;
+#endif
+
+// Named event that other event loops can wait on next to their sockets and timers:
+// a manual-reset event on Windows, a FIFO in /dev/shm elsewhere, readable while signaled.
+// Every process that opens the same name shares the signal.
+class PollEvent {
+public:
+    explicit PollEvent(const std::wstring& name);
+    ~PollEvent();
+
+    PollEvent(const PollEvent&) = delete;
+    PollEvent& operator=(const PollEvent&) = delete;
+
+    // For epoll, poll or WaitForMultipleObjects; -1 or null when the event could not be made
+    PollDescriptor descriptor() const;
+
+    // Never blocks, signaling an event that is signaled already changes nothing
+    void signal();
+    // Makes the descriptor quiet again
+    void reset();
+
+    static void remove(const std::wstring& name);
+
+private:
+    PollDescriptor handle;
+};
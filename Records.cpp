@@ -0,0 +1,269 @@
+#include "Records.h"
+
+#include "pagecopy.h"
+#include "platform.h"
+#include "lz.h"
+
+#include <algorithm>
+
+namespace {
+
+// Most a compressed page may decode to, so staging stays bounded
+const size_t MAX_PAGE_RATIO = 16;
+
+}
+
+RecordWriter::RecordWriter(PagePool& pool)
+    : pool(pool)
+    , used(0)
+    , locked(false)
+    , failed(false)
+    , compress(pool.geometry().compression)
+    , stagedStart(0)
+{}
+
+RecordWriter::~RecordWriter() {
+    discard();
+}
+
+PageSpan RecordWriter::grow() {
+    // Staged data comes first
+    while (stagedStart < staged.size()) {
+        if (!packPage()) {
+            return {nullptr, 0};
+        }
+    }
+    return appendPage();
+}
+
+PageSpan RecordWriter::appendPage() {
+    // Broadcast pages are recycled by sequence number, a chain cannot be held back from that
+    if (pool.isBroadcast() || (int)pages.size() == pool.geometry().pagesCount) {
+        return {nullptr, 0};
+    }
+    if (!locked) {
+        // Budget waits happen before the lock, the rest of the record goes on credit
+        pool.takeBudget(1);
+        std::atomic<uint32_t>& assembly = pool.shared.assembly();
+        waitFor(pool.assemblyEvent, [&]() {
+            uint32_t expected = 0;
+            return assembly.compare_exchange_strong(expected, processId(), std::memory_order_acquire);
+        });
+        locked = true;
+    }
+    if (!pages.empty()) {
+        pool.chargeBudget(1);
+    }
+    uint32_t lease = 0;
+    int page = pool.takePage(false, lease);
+    if (!pages.empty()) {
+        PageMeta& last = pool.shared.pageMeta(pages.back());
+        last.length = used;
+        last.next = page;
+    }
+    pages.push_back(page);
+    leases.push_back(lease);
+    used = 0;
+    return pool.page(page);
+}
+
+void RecordWriter::fill(size_t bytes) {
+    used = std::min(bytes, (size_t)pool.geometry().pageSize);
+}
+
+bool RecordWriter::write(const void* data, size_t size) {
+    if (failed) {
+        return false;
+    }
+    auto src = (const char*)data;
+    size_t pageSize = pool.geometry().pageSize;
+    if (compress) {
+        staged.insert(staged.end(), src, src + size);
+        // Enough for the best case page, anything less might still compress better with what comes next
+        while (staged.size() - stagedStart >= pageSize * MAX_PAGE_RATIO) {
+            if (!packPage()) {
+                failed = true;
+                return false;
+            }
+        }
+        return true;
+    }
+    while (size > 0) {
+        if (pages.empty() || used == pageSize) {
+            if (!grow().data) {
+                failed = true;
+                return false;
+            }
+        }
+        size_t chunk = std::min(size, pageSize - used);
+        copyPage(pool.page(pages.back()).data + used, src, chunk);
+        used += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+bool RecordWriter::packPage() {
+    size_t pageSize = pool.geometry().pageSize;
+    PageSpan page = appendPage();
+    if (!page.data) {
+        return false;
+    }
+    const char* src = staged.data() + stagedStart;
+    size_t available = staged.size() - stagedStart;
+    size_t consumed = 0;
+    size_t stored = lzCompress(src, std::min(available, pageSize * MAX_PAGE_RATIO), page.data, pageSize, consumed);
+    CompressionStats& stats = pool.compressionStats;
+    // An eighth saved at least, otherwise readers pay for decoding for nothing
+    if (consumed > 0 && stored + stored / 8 < consumed) {
+        pool.shared.pageMeta(pages.back()).rawLength = consumed;
+        ++stats.compressed;
+        size_t ratio = consumed / stored;
+        ++stats.ratios[ratio < 2 ? 0 : ratio < 4 ? 1 : ratio < 8 ? 2 : 3];
+    } else {
+        consumed = std::min(available, pageSize);
+        stored = consumed;
+        copyPage(page.data, src, consumed);
+        ++stats.bypassed;
+    }
+    stats.rawBytes += consumed;
+    stats.storedBytes += stored;
+    used = stored;
+    stagedStart += consumed;
+    if (stagedStart == staged.size()) {
+        staged.clear();
+        stagedStart = 0;
+    } else if (stagedStart >= staged.size() / 2) {
+        staged.erase(staged.begin(), staged.begin() + stagedStart);
+        stagedStart = 0;
+    }
+    return true;
+}
+
+int64_t RecordWriter::commit() {
+    if (failed) {
+        discard();
+        return -1;
+    }
+    while (stagedStart < staged.size()) {
+        if (!packPage()) {
+            discard();
+            return -1;
+        }
+    }
+    if (pages.empty() && !grow().data) {
+        return -1;
+    }
+    PageMeta& last = pool.shared.pageMeta(pages.back());
+    last.length = used;
+    last.next = -1;
+    // Readers take the chain over along with the head
+    for (size_t i = 1; i < pages.size(); ++i) {
+        pool.shared.handOver(&pages[i], 1, leases[i]);
+    }
+    // The assembly lock only guards against waiting for pages, publishing needs none
+    unlock();
+    auto sequence = (int64_t)pool.release(pages.front(), leases.front(), false);
+    pages.clear();
+    leases.clear();
+    return sequence;
+}
+
+void RecordWriter::discard() {
+    if (!pages.empty()) {
+        // Straight back to the free ring, readers never saw these
+        uint64_t position = 0;
+        for (size_t i = 0; i < pages.size(); ++i) {
+            position = pool.shared.returnPages(&pages[i], 1, true, leases[i]);
+        }
+        pool.wake(pool.outputEvent(true), pages.size());
+        pool.signalPoll(false, position);
+        pages.clear();
+        leases.clear();
+    }
+    used = 0;
+    staged.clear();
+    stagedStart = 0;
+    failed = false;
+    unlock();
+}
+
+void RecordWriter::unlock() {
+    if (!locked) {
+        return;
+    }
+    pool.shared.assembly().store(0, std::memory_order_release);
+    pool.assemblyEvent.notify();
+    locked = false;
+}
+
+RecordLease::RecordLease(PagePool& pool)
+    : head(pool.lease(true))
+{
+    size_t rawSize = 0;
+    for (int page = head.index(); page >= 0; page = pool.shared.pageMeta(page).next) {
+        const PageMeta& meta = pool.shared.pageMeta(page);
+        PageSpan span = pool.page(page);
+        span.size = meta.length;
+        payload.push_back(span);
+        totalSize += span.size;
+        rawSize += meta.rawLength > 0 ? meta.rawLength : meta.length;
+    }
+    if (rawSize == totalSize) {
+        return;
+    }
+    decoded.resize(rawSize);
+    size_t offset = 0;
+    int page = head.index();
+    for (const PageSpan& span : payload) {
+        const PageMeta& meta = pool.shared.pageMeta(page);
+        if (meta.rawLength == 0) {
+            copyPage(decoded.data() + offset, span.data, span.size);
+        } else if (meta.rawLength > rawSize - offset || !lzDecompress(span.data, span.size, decoded.data() + offset, meta.rawLength)) {
+            payload.clear();
+            totalSize = 0;
+            return;
+        }
+        offset += meta.rawLength > 0 ? meta.rawLength : meta.length;
+        page = meta.next;
+    }
+    payload.assign(1, {decoded.data(), rawSize});
+    totalSize = rawSize;
+}
+
+RecordLease::operator bool() const {
+    return (bool)head;
+}
+
+uint64_t RecordLease::sequence() const {
+    return head.sequence();
+}
+
+size_t RecordLease::size() const {
+    return totalSize;
+}
+
+const std::vector<PageSpan>& RecordLease::spans() const {
+    return payload;
+}
+
+PageSpan RecordLease::contiguous() const {
+    if (payload.empty()) {
+        return {nullptr, 0};
+    }
+    // Every page but the last has to be full and directly followed by the next one
+    for (size_t i = 0; i + 1 < payload.size(); ++i) {
+        if (payload[i].data + payload[i].size != payload[i + 1].data) {
+            return {nullptr, 0};
+        }
+    }
+    return {payload.front().data, totalSize};
+}
+
+void RecordLease::release() {
+    head.release();
+    payload.clear();
+    totalSize = 0;
+    decoded.clear();
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "PagePool.h"
+
+#include <vector>
+
+// Builds a record of any length over a chain of pages, nothing reaches readers before commit().
+// Pages are filled in place through grow()/fill(), or by copying with write(). In pools with
+// compression write() packs the data into pages LZ compressed, grown pages are stored as is.
+class RecordWriter {
+public:
+    explicit RecordWriter(PagePool& pool);
+    // An uncommitted record goes back to the free pages
+    ~RecordWriter();
+
+    RecordWriter(const RecordWriter&) = delete;
+    RecordWriter& operator=(const RecordWriter&) = delete;
+
+    // Appends a page and returns its whole payload area. Empty once the record spans the entire pool,
+    // and always in broadcast mode, which has no records.
+    PageSpan grow();
+    // Marks the first bytes of the last page as payload
+    void fill(size_t bytes);
+
+    // Copies data at the end of the record, growing it as needed. False if the pool is too small,
+    // the record is then broken and commit() drops it. With compression the data is staged and may
+    // only reach pages on commit.
+    bool write(const void* data, size_t size);
+
+    // Publishes the record as a single ready entry and returns its sequence number,
+    // -1 when it has no page to go in: always in broadcast mode, after a failed write(), and when
+    // compressed data does not fit the pool. A record that fails is dropped whole, never published in part.
+    int64_t commit();
+
+private:
+    PageSpan appendPage();
+    // Fills a new page from the staged data, compressed unless that saves too little
+    bool packPage();
+    // Drops the record: pages back to the free ring, staged data gone
+    void discard();
+    void unlock();
+
+    PagePool& pool;
+    std::vector<int> pages;
+    // The lease number each page was taken under
+    std::vector<uint32_t> leases;
+    size_t used;
+    bool locked;
+    // A write() did not fit
+    bool failed;
+    bool compress;
+    std::vector<char> staged;
+    size_t stagedStart;
+};
+
+// A received record: the chain of pages in order, handed back when the lease ends.
+// Records with compressed pages are decoded into a buffer of the lease, which is then the one span.
+// A page that does not decode leaves the record empty.
+class RecordLease {
+public:
+    RecordLease() = default;
+    // Waits for the next record
+    explicit RecordLease(PagePool& pool);
+
+    explicit operator bool() const;
+
+    uint64_t sequence() const;
+    size_t size() const;
+
+    // Scatter list of the payload, each span trimmed to the bytes used in its page
+    const std::vector<PageSpan>& spans() const;
+    // When the pages happen to be adjacent in the mapping the record is one span, otherwise empty
+    PageSpan contiguous() const;
+
+    void release();
+
+private:
+    PageLease head;
+    std::vector<PageSpan> payload;
+    size_t totalSize = 0;
+    std::vector<char> decoded;
+};
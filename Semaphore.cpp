@@ -0,0 +1,68 @@
+#include "Semaphore.h"
+
+#include "platform.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <cerrno>
+#endif
+
+#ifdef _WIN32
+
+Semaphore::Semaphore(const std::wstring& name, int initial, int max) {
+    sem = CreateSemaphoreW(nullptr, initial, max, name.c_str());
+    if (!sem) {
+        systemFailure("CreateSemaphore", posixName(name));
+    }
+}
+
+Semaphore::~Semaphore() {
+    CloseHandle(sem);
+}
+
+void Semaphore::acquire() {
+    WaitForSingleObject(sem, INFINITE);
+}
+
+void Semaphore::release(int count) {
+    ReleaseSemaphore(sem, count, nullptr);
+}
+
+void Semaphore::remove(const std::wstring& name) {
+    // Semaphores die with their last handle
+}
+
+HANDLE Semaphore::handle() const {
+    return sem;
+}
+
+#else
+
+Semaphore::Semaphore(const std::wstring& name, int initial, [[maybe_unused]] int max) {
+    // POSIX semaphores have no maximum, the protocol never releases more than it acquired
+    sem = sem_open(posixName(name).c_str(), O_CREAT, 0666, initial);
+    if (sem == SEM_FAILED) {
+        systemFailure("sem_open", posixName(name));
+    }
+}
+
+Semaphore::~Semaphore() {
+    sem_close(sem);
+}
+
+void Semaphore::acquire() {
+    while (sem_wait(sem) != 0 && errno == EINTR) {
+    }
+}
+
+void Semaphore::release(int count) {
+    for (int i = 0; i < count; ++i) {
+        sem_post(sem);
+    }
+}
+
+void Semaphore::remove(const std::wstring& name) {
+    sem_unlink(posixName(name).c_str());
+}
+
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <semaphore.h>
+#endif
+
+class Semaphore {
+public:
+    Semaphore(const std::wstring& name, int initial, int max);
+    ~Semaphore();
+
+    Semaphore(const Semaphore&) = delete;
+    Semaphore& operator=(const Semaphore&) = delete;
+
+    void acquire();
+    void release(int count = 1);
+
+    static void remove(const std::wstring& name);
+
+#ifdef _WIN32
+    // For waiting on several objects at once
+    HANDLE handle() const;
+#endif
+
+private:
+#ifdef _WIN32
+    HANDLE sem;
+#else
+    sem_t* sem;
+#endif
+};
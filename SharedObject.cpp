@@ -0,0 +1,1060 @@
+#include "SharedObject.h"
+
+#include "platform.h"
+
+#include <thread>
+#include <new>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <initializer_list>
+#include <algorithm>
+
+namespace {
+
+enum : uint32_t {
+    Fresh = 0,
+    Initializing,
+    Ready,
+};
+
+const int CACHE_LINE = 64;
+const int MAX_PAGES = 65536;
+const int MAX_SNAPSHOT = 1024*1024;
+// Ticket owner of a waiter that left the line
+const uint32_t LEFT_LINE = UINT32_MAX;
+// Joiners give up on a creator that has not finished by then, prefaulting a large pool included
+const uint64_t INIT_WAIT_MS = 30000;
+
+uint64_t holderWord(uint32_t pid, uint32_t lease) {
+    return (uint64_t)lease << 32 | pid;
+}
+
+uint32_t holderPid(uint64_t holder) {
+    return (uint32_t)holder;
+}
+
+size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+}
+
+const char* fairnessName(Fairness fairness) {
+    switch (fairness) {
+    case Fairness::Fifo: return "fifo";
+    case Fairness::ReaderPriority: return "readers";
+    case Fairness::WriterPriority: return "writers";
+    default: return "race";
+    }
+}
+
+bool parseFairness(const std::string& name, Fairness& fairness) {
+    for (Fairness candidate : {Fairness::Race, Fairness::Fifo, Fairness::ReaderPriority, Fairness::WriterPriority}) {
+        if (name == fairnessName(candidate)) {
+            fairness = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+PoolGeometry PoolGeometry::normalized() const {
+    PoolGeometry result;
+    result.pagesCount = std::max(1, std::min(pagesCount, MAX_PAGES));
+    result.pageSize = (int)alignUp(std::max(pageSize, CACHE_LINE), CACHE_LINE);
+    result.mode = mode;
+    result.budgets = budgets && mode == PoolMode::Queue;
+    result.fairness = fairness;
+    result.stealing = stealing && mode == PoolMode::Queue;
+    result.checksums = checksums;
+    result.compression = compression && mode == PoolMode::Queue;
+    result.snapshotSize = std::max(0, std::min(snapshotSize, MAX_SNAPSHOT));
+    result.packedHeaders = packedHeaders;
+    return result;
+}
+
+size_t PageRing::bytes(int capacity) {
+    return alignUp(sizeof(PageRing), alignof(Cell)) + capacity * sizeof(Cell);
+}
+
+void PageRing::init(int ringCapacity) {
+    capacity = ringCapacity;
+    tail.store(0, std::memory_order_relaxed);
+    head.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < ringCapacity; ++i) {
+        cells()[i].sequence.store(i, std::memory_order_relaxed);
+        cells()[i].page = -1;
+    }
+}
+
+bool PageRing::tryPush(const int* pages, int count, uint64_t& position) {
+    uint64_t pos = tail.load(std::memory_order_relaxed);
+    while (true) {
+        // The whole batch has to fit, so it gets consecutive positions from a single claim
+        bool stale = false;
+        for (int k = 0; k < count; ++k) {
+            uint64_t seq = cells()[(pos + k) % capacity].sequence.load(std::memory_order_acquire);
+            auto diff = (int64_t)(seq - (pos + k));
+            if (diff < 0) {
+                return false;
+            }
+            if (diff > 0) {
+                stale = true;
+                break;
+            }
+        }
+        if (stale) {
+            pos = tail.load(std::memory_order_relaxed);
+            continue;
+        }
+        if (tail.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+            for (int k = 0; k < count; ++k) {
+                Cell& cell = cells()[(pos + k) % capacity];
+                cell.page = pages[k];
+                cell.sequence.store(pos + k + 1, std::memory_order_release);
+            }
+            position = pos;
+            return true;
+        }
+    }
+}
+
+int PageRing::tryPop(int* pages, int maxCount, uint64_t& position) {
+    uint64_t pos = head.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& first = cells()[pos % capacity];
+        auto diff = (int64_t)(first.sequence.load(std::memory_order_acquire) - (pos + 1));
+        if (diff < 0) {
+            return 0;
+        }
+        if (diff > 0) {
+            pos = head.load(std::memory_order_relaxed);
+            continue;
+        }
+        // Take the published run after the first cell too
+        int count = 1;
+        while (count < maxCount) {
+            uint64_t seq = cells()[(pos + count) % capacity].sequence.load(std::memory_order_acquire);
+            if (seq != pos + count + 1) {
+                break;
+            }
+            ++count;
+        }
+        if (head.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+            for (int k = 0; k < count; ++k) {
+                Cell& cell = cells()[(pos + k) % capacity];
+                pages[k] = cell.page;
+                cell.sequence.store(pos + k + capacity, std::memory_order_release);
+            }
+            position = pos;
+            return count;
+        }
+    }
+}
+
+uint32_t PageRing::size() const {
+    uint64_t first = head.load(std::memory_order_relaxed);
+    uint64_t last = tail.load(std::memory_order_relaxed);
+    return last > first ? (uint32_t)std::min<uint64_t>(last - first, capacity) : 0;
+}
+
+PageRing::Cell* PageRing::cells() {
+    return (Cell*)((char*)this + alignUp(sizeof(PageRing), alignof(Cell)));
+}
+
+SharedObject::SharedObject(void* mapView)
+    : header((PoolHeader*)mapView)
+    , slots(nullptr)
+    , slotStride(0)
+    , payloads(nullptr)
+    , initializing(false)
+    , rebooted(false)
+    , freePages(nullptr)
+    , readyPages(nullptr)
+    , freeEvent(nullptr)
+    , readyEvent(nullptr)
+    , assemblyLock(nullptr)
+    , assemblyWaiters(nullptr)
+    , claimCursor(nullptr)
+    , leaseCounter(nullptr)
+    , readerCursors(nullptr)
+    , processes(nullptr)
+    , writerBuckets(nullptr)
+    , drainedPages(nullptr)
+    , drainSample(nullptr)
+    , writerLine(nullptr)
+    , readerLine(nullptr)
+    , commitCounter(nullptr)
+    , queueCount(nullptr)
+    , queues(nullptr)
+    , queueStride(0)
+    , snapshot(nullptr)
+    , readerPoll(nullptr)
+    , writerPoll(nullptr)
+{}
+
+size_t SharedObject::bytes(const PoolGeometry& geometry) {
+    SharedObject probe(nullptr);
+    return probe.layout(0, geometry);
+}
+
+bool SharedObject::init(bool created, const PoolGeometry& geometry) {
+    uint32_t expected = Fresh;
+    if (created && header->initState.compare_exchange_strong(expected, Initializing, std::memory_order_acquire)) {
+        header->magic = POOL_MAGIC;
+        header->version = POOL_VERSION;
+        header->pagesCount = geometry.pagesCount;
+        header->pageSize = geometry.pageSize;
+        header->mode = geometry.mode;
+        header->budgets = geometry.budgets;
+        header->fairness = geometry.fairness;
+        header->stealing = geometry.stealing;
+        header->checksums = geometry.checksums;
+        header->compression = geometry.compression;
+        header->snapshotSize = geometry.snapshotSize;
+        header->packedHeaders = geometry.packedHeaders;
+        header->bootId = bootId();
+        layout((uintptr_t)header, geometry);
+        freePages->init(geometry.pagesCount);
+        readyPages->init(geometry.pagesCount);
+        for (int queue = 0; geometry.stealing && queue < MAX_READERS; ++queue) {
+            queueRing(queue).init(std::min(geometry.pagesCount, QUEUE_PAGES));
+        }
+        for (int i = 0; i < geometry.pagesCount; ++i) {
+            uint64_t position;
+            freePages->tryPush(&i, 1, position);
+        }
+        initializing = true;
+        return true;
+    }
+    uint64_t start = monotonicMs();
+    while (true) {
+        while (header->initState.load(std::memory_order_acquire) != Ready) {
+            if (monotonicMs() - start >= INIT_WAIT_MS) {
+                std::fprintf(stderr, "pool never finished initializing, its creator is gone or stuck; remove the channel and start again\n");
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        if (header->magic != POOL_MAGIC || header->version != POOL_VERSION) {
+            return false;
+        }
+        if (sameBoot(header->bootId, bootId())) {
+            break;
+        }
+        // Persisted through a reboot: the first joiner recovers it, the others wait as for a creator
+        expected = Ready;
+        if (header->initState.compare_exchange_strong(expected, Initializing, std::memory_order_acquire)) {
+            rebooted = true;
+            break;
+        }
+    }
+    layout((uintptr_t)header, this->geometry());
+    return true;
+}
+
+size_t SharedObject::pagesBytes(const PoolGeometry& geometry) {
+    return (size_t)geometry.pagesCount * (geometry.pageSize + headerStride(geometry));
+}
+
+void SharedObject::attachPages(void* pagesView) {
+    PoolGeometry geometry = this->geometry();
+    // Payloads first, at the alignment of the mapping; the page size keeps the headers cache-line aligned
+    payloads = (char*)pagesView;
+    slots = payloads + (size_t)geometry.pagesCount * geometry.pageSize;
+    slotStride = headerStride(geometry);
+    if (initializing) {
+        // A page mapping left behind by an older pool may still hold its headers
+        for (uint32_t page = 0; page < header->pagesCount; ++page) {
+            new (&slot(page)) PageHeader();
+        }
+        header->initState.store(Ready, std::memory_order_release);
+        initializing = false;
+    } else if (rebooted) {
+        forgetOwners();
+        header->bootId = bootId();
+        header->initState.store(Ready, std::memory_order_release);
+        rebooted = false;
+    }
+}
+
+char* SharedObject::payload(int page) {
+    return payloads + (size_t)page * header->pageSize;
+}
+
+PoolGeometry SharedObject::geometry() const {
+    PoolGeometry result;
+    result.pagesCount = header->pagesCount;
+    result.pageSize = header->pageSize;
+    result.mode = header->mode;
+    result.budgets = header->budgets != 0;
+    result.fairness = header->fairness;
+    result.stealing = header->stealing != 0;
+    result.checksums = header->checksums != 0;
+    result.compression = header->compression != 0;
+    result.snapshotSize = header->snapshotSize;
+    result.packedHeaders = header->packedHeaders != 0;
+    return result;
+}
+
+int SharedObject::takePages(bool isChit, int* pages, int maxCount, uint32_t& lease, int queue) {
+    PageRing* ring = isChit ? readyPages : freePages;
+    bool stealing = isChit && header->stealing;
+    uint64_t position;
+    int count = stealing ? takeQueued(queue, pages, maxCount, position) : ring->tryPop(pages, maxCount, position);
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t self = processId();
+    uint64_t now = monotonicMs();
+    lease = newLease();
+    for (int k = 0; k < count; ++k) {
+        PageHeader& page = slot(pages[k]);
+        hold(page, self, lease, now);
+        if (isChit) {
+            // Work-stealing commits number their pages themselves
+            if (!stealing) {
+                page.sequence = position + k;
+            }
+            // The rest of a record comes along with its head
+            for (int next = page.meta.next; next >= 0; next = slot(next).meta.next) {
+                hold(slot(next), self, lease, now);
+            }
+        } else {
+            page.meta = {header->pageSize, -1, 0, 0};
+        }
+    }
+    return count;
+}
+
+uint64_t SharedObject::returnPages(const int* pages, int count, bool isChit, uint32_t lease) {
+    PageRing* ring = isChit ? freePages : readyPages;
+    bool skipped = false;
+    std::vector<int> owned;
+    for (int k = 0; k < count; ++k) {
+        PageHeader& page = slot(pages[k]);
+        if (!giveUp(page, lease)) {
+            // Reclaimed while we stalled, it is somebody else's by now
+            if (!skipped) {
+                owned.assign(pages, pages + k);
+                skipped = true;
+            }
+            continue;
+        }
+        if (skipped) {
+            owned.push_back(pages[k]);
+        }
+        page.state.store(isChit ? PageState::CanWrite : PageState::CanRead, std::memory_order_relaxed);
+    }
+    if (skipped) {
+        if (owned.empty()) {
+            return 0;
+        }
+        pages = owned.data();
+        count = owned.size();
+    }
+    if (!isChit && header->stealing) {
+        return queuePages(pages, count);
+    }
+    // Slots only look full while consumers are still releasing them
+    uint64_t position;
+    while (!ring->tryPush(pages, count, position)) {
+        std::this_thread::yield();
+    }
+    return position;
+}
+
+int SharedObject::joinQueue() {
+    uint32_t self = processId();
+    for (int queue = 0; queue < MAX_READERS; ++queue) {
+        std::atomic<uint32_t>& owner = readerQueue(queue).pid;
+        uint32_t pid = owner.load();
+        // Another thread of this process holds it when the pid is ours
+        bool free = pid == 0 || (pid != self && !processAlive(pid));
+        if (free && owner.compare_exchange_strong(pid, self)) {
+            uint32_t count = queueCount->load();
+            while (count < (uint32_t)queue + 1 && !queueCount->compare_exchange_weak(count, queue + 1)) {
+            }
+            return queue;
+        }
+    }
+    return -1;
+}
+
+void SharedObject::leaveQueue(int queue) {
+    readerQueue(queue).pid.store(0, std::memory_order_release);
+}
+
+uint64_t SharedObject::queuePages(const int* pages, int count) {
+    uint64_t sequence = commitCounter->fetch_add(count);
+    for (int k = 0; k < count; ++k) {
+        slot(pages[k]).sequence = sequence + k;
+    }
+    int target = -1;
+    uint32_t least = UINT32_MAX;
+    int queues = (int)queueCount->load();
+    for (int queue = 0; queue < queues; ++queue) {
+        if (readerQueue(queue).pid.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        PageRing& ring = queueRing(queue);
+        uint32_t size = ring.size();
+        if (size < least && size + count <= ring.capacity) {
+            least = size;
+            target = queue;
+        }
+    }
+    // The cell stores publish the sequence numbers along with the pages
+    uint64_t position;
+    if (target >= 0 && queueRing(target).tryPush(pages, count, position)) {
+        return sequence;
+    }
+    while (!readyPages->tryPush(pages, count, position)) {
+        std::this_thread::yield();
+    }
+    return sequence;
+}
+
+int SharedObject::takeQueued(int queue, int* pages, int maxCount, uint64_t& position) {
+    int count = queue >= 0 ? queueRing(queue).tryPop(pages, maxCount, position) : 0;
+    if (count == 0) {
+        count = readyPages->tryPop(pages, maxCount, position);
+    }
+    if (count > 0) {
+        return count;
+    }
+    // Steal half of the fullest queue, which keeps thieves off the short ones their owners are busy with
+    int victim = -1;
+    uint32_t most = 0;
+    int queues = (int)queueCount->load();
+    for (int other = 0; other < queues; ++other) {
+        uint32_t size = queueRing(other).size();
+        if (other != queue && size > most) {
+            most = size;
+            victim = other;
+        }
+    }
+    if (victim < 0) {
+        return 0;
+    }
+    return queueRing(victim).tryPop(pages, std::min(maxCount, (int)std::max(1u, most / 2)), position);
+}
+
+ReaderQueue& SharedObject::readerQueue(int queue) const {
+    return *(ReaderQueue*)(queues + queue * queueStride);
+}
+
+PageRing& SharedObject::queueRing(int queue) const {
+    return *(PageRing*)(queues + queue * queueStride + sizeof(ReaderQueue));
+}
+
+int SharedObject::subscribe() {
+    for (int reader = 0; reader < MAX_READERS; ++reader) {
+        ReaderCursor& cursor = readerCursors[reader];
+        uint32_t expected = 0;
+        if (cursor.active.compare_exchange_strong(expected, 1)) {
+            // Only what gets claimed from now on: writers that claimed earlier did not wait for us
+            cursor.next.store(claimCursor->load());
+            cursor.pid.store(processId());
+            cursor.active.store(2);
+            return reader;
+        }
+    }
+    return -1;
+}
+
+void SharedObject::unsubscribe(int reader) {
+    readerCursors[reader].active.store(0, std::memory_order_release);
+}
+
+int SharedObject::claimSlots(int* pages, int maxCount, uint32_t& lease) {
+    uint64_t pagesCount = header->pagesCount;
+    uint64_t claim = claimCursor->load(std::memory_order_relaxed);
+    while (true) {
+        uint64_t gate = claim + pagesCount;
+        for (int reader = 0; reader < MAX_READERS; ++reader) {
+            ReaderCursor& cursor = readerCursors[reader];
+            uint32_t active = cursor.active.load();
+            if (active == 1) {
+                // Still picking its start, hold off until it has one
+                gate = claim;
+            } else if (active == 2) {
+                gate = std::min(gate, cursor.next.load(std::memory_order_acquire) + pagesCount);
+            }
+        }
+        // The previous lap of a page also has to be published, a slow writer may still hold it
+        int count = 0;
+        while (count < maxCount && claim + count < gate) {
+            uint64_t seq = claim + count;
+            uint64_t previous = slot(seq % pagesCount).published.load(std::memory_order_acquire);
+            if (seq >= pagesCount && previous != seq - pagesCount + 1) {
+                break;
+            }
+            ++count;
+        }
+        if (count == 0) {
+            return 0;
+        }
+        if (claimCursor->compare_exchange_weak(claim, claim + count)) {
+            uint32_t self = processId();
+            uint64_t now = monotonicMs();
+            lease = newLease();
+            for (int k = 0; k < count; ++k) {
+                pages[k] = (int)((claim + k) % pagesCount);
+                PageHeader& page = slot(pages[k]);
+                hold(page, self, lease, now);
+                page.sequence = claim + k;
+                page.meta = {header->pageSize, -1, 0, 0};
+            }
+            return count;
+        }
+    }
+}
+
+void SharedObject::publishSlots(const int* pages, int count, uint32_t lease) {
+    for (int k = 0; k < count; ++k) {
+        PageHeader& page = slot(pages[k]);
+        // A reclaimed slot was published empty and may carry a later lap by now
+        if (!giveUp(page, lease)) {
+            continue;
+        }
+        page.state.store(PageState::CanRead, std::memory_order_relaxed);
+        page.published.store(page.sequence + 1, std::memory_order_release);
+    }
+}
+
+int SharedObject::readSlots(uint64_t from, int* pages, int maxCount) {
+    uint64_t pagesCount = header->pagesCount;
+    int count = 0;
+    while (count < maxCount) {
+        uint64_t seq = from + count;
+        if (slot(seq % pagesCount).published.load(std::memory_order_acquire) != seq + 1) {
+            break;
+        }
+        pages[count++] = (int)(seq % pagesCount);
+    }
+    return count;
+}
+
+void SharedObject::advanceCursor(int reader, uint64_t next) {
+    // Right before the cursors lies the claim cursor, a stray index would rewind it
+    if (reader < 0 || reader >= MAX_READERS) {
+        return;
+    }
+    readerCursors[reader].next.store(next, std::memory_order_release);
+}
+
+uint64_t SharedObject::readerNext(int reader) const {
+    return readerCursors[reader].next.load(std::memory_order_acquire);
+}
+
+EventWord* SharedObject::pageEvent(bool isChit) {
+    return isChit ? readyEvent : freeEvent;
+}
+
+void SharedObject::handOver(const int* pages, int count, uint32_t lease) {
+    for (int k = 0; k < count; ++k) {
+        PageHeader& page = slot(pages[k]);
+        if (giveUp(page, lease)) {
+            page.state.store(PageState::CanRead, std::memory_order_relaxed);
+        }
+    }
+}
+
+int SharedObject::attachProcess() {
+    uint32_t self = processId();
+    for (int process = 0; process < MAX_PROCESSES; ++process) {
+        if (processes[process].pid.load() == self) {
+            heartbeat(process);
+            return process;
+        }
+    }
+    for (int process = 0; process < MAX_PROCESSES; ++process) {
+        uint32_t pid = processes[process].pid.load();
+        if ((pid == 0 || !processAlive(pid)) && processes[process].pid.compare_exchange_strong(pid, self)) {
+            heartbeat(process);
+            return process;
+        }
+    }
+    return -1;
+}
+
+void SharedObject::heartbeat(int process) {
+    if (process >= 0) {
+        processes[process].heartbeat.store(monotonicMs(), std::memory_order_relaxed);
+    }
+}
+
+Reclaimed SharedObject::reclaim(uint64_t staleMs) {
+    Reclaimed result;
+    uint32_t self = processId();
+    uint64_t now = monotonicMs();
+    for (int index = 0; index < (int)header->pagesCount; ++index) {
+        PageHeader& page = slot(index);
+        uint64_t holder = page.holder.load(std::memory_order_acquire);
+        uint32_t owner = holderPid(holder);
+        if (owner == 0 || !ownerGone(owner, page.leaseTime.load(), staleMs, now)) {
+            continue;
+        }
+        // Whoever swaps the holder out does the rest, under a lease of its own the old one cannot match
+        uint32_t taken = newLease();
+        if (page.holder.compare_exchange_strong(holder, holderWord(self, taken))) {
+            takeBack(index, taken, result);
+        }
+    }
+    for (int reader = 0; reader < MAX_READERS; ++reader) {
+        ReaderCursor& cursor = readerCursors[reader];
+        uint32_t pid = cursor.pid.load();
+        uint32_t active = 2;
+        if (pid != 0 && cursor.active.load() == 2 && ownerGone(pid, 0, staleMs, now)
+            && cursor.active.compare_exchange_strong(active, 0)) {
+            ++result.readers;
+        }
+    }
+    for (bool isChit : {false, true}) {
+        TicketLine* line = isChit ? readerLine : writerLine;
+        uint64_t serving = line->serving.load();
+        std::atomic<uint32_t>& turn = line->owners[serving % TICKET_OWNERS];
+        uint32_t owner = turn.load();
+        if (serving >= line->next.load() || owner == 0 || owner == self) {
+            continue;
+        }
+        // A waiter that left the line is as good as dead, the mark says who passes its turn
+        if (owner == LEFT_LINE) {
+            if (turn.compare_exchange_strong(owner, 0)) {
+                passTurn(isChit, serving);
+                ++result.turns;
+            }
+        } else if (!processAlive(owner) && line->serving.compare_exchange_strong(serving, serving + 1)) {
+            ++result.turns;
+        }
+    }
+    uint32_t holder = assemblyLock->load();
+    if (holder != 0 && holder != self && !processAlive(holder)) {
+        result.assembly = assemblyLock->compare_exchange_strong(holder, 0);
+    }
+    if (snapshot) {
+        uint32_t writer = snapshot->writer.load();
+        if (writer != 0 && writer != self && !processAlive(writer) && snapshot->writer.compare_exchange_strong(writer, self)) {
+            // Dead before it made the version odd there is nothing to undo, after it whatever it copied is torn
+            uint64_t version = snapshot->version.load();
+            if ((version & 1) != 0) {
+                snapshot->length = 0;
+                snapshot->version.store(version + 1, std::memory_order_release);
+            }
+            snapshot->writer.store(0, std::memory_order_release);
+            result.snapshot = true;
+        }
+    }
+    return result;
+}
+
+void SharedObject::takeBack(int page, uint32_t lease, Reclaimed& result) {
+    if (header->mode == PoolMode::Broadcast) {
+        // Readers expect every sequence, so the slot still gets published, just empty
+        slot(page).meta = {0, -1, 0, 0};
+        publishSlots(&page, 1, lease);
+        ++result.publishedPages;
+    } else {
+        returnPages(&page, 1, true, lease);
+        ++result.freePages;
+    }
+}
+
+void SharedObject::forgetOwners() {
+    // Nobody else is attached yet, the pool is not Ready. Our own pid may be among the old ones.
+    Reclaimed result;
+    uint32_t self = processId();
+    for (int index = 0; index < (int)header->pagesCount; ++index) {
+        PageHeader& page = slot(index);
+        if (page.holder.load() != 0) {
+            uint32_t taken = newLease();
+            page.holder.store(holderWord(self, taken));
+            takeBack(index, taken, result);
+        }
+    }
+    for (int reader = 0; reader < MAX_READERS; ++reader) {
+        readerCursors[reader].active.store(0);
+        readerCursors[reader].pid.store(0);
+    }
+    for (int process = 0; process < MAX_PROCESSES; ++process) {
+        processes[process].pid.store(0);
+        processes[process].heartbeat.store(0);
+    }
+    for (int writer = 0; writer < MAX_WRITERS; ++writer) {
+        writerBuckets[writer].pid.store(0);
+    }
+    // Monotonic times of the old boot mean nothing in this one
+    drainSample->time.store(0);
+    for (TicketLine* line : {writerLine, readerLine}) {
+        line->serving.store(line->next.load());
+        for (std::atomic<uint32_t>& owner : line->owners) {
+            owner.store(0);
+        }
+    }
+    for (int queue = 0; header->stealing && queue < MAX_READERS; ++queue) {
+        readerQueue(queue).pid.store(0);
+    }
+    assemblyLock->store(0);
+    if (snapshot) {
+        uint64_t version = snapshot->version.load();
+        if ((version & 1) != 0) {
+            snapshot->length = 0;
+            snapshot->version.store(version + 1);
+        }
+        snapshot->writer.store(0);
+    }
+    for (PollSignal* poll : {readerPoll, writerPoll}) {
+        poll->pollers.store(0);
+    }
+}
+
+int SharedObject::attachWriter() {
+    uint32_t self = processId();
+    for (int writer = 0; writer < MAX_WRITERS; ++writer) {
+        WriterBucket& bucket = writerBuckets[writer];
+        uint32_t pid = bucket.pid.load();
+        if ((pid == 0 || (pid != self && !processAlive(pid))) && bucket.pid.compare_exchange_strong(pid, self)) {
+            // A new writer starts with a full page, it has not been measured yet
+            bucket.tokens.store(1000);
+            bucket.lastRefill.store(monotonicMs());
+            bucket.rate.store(0);
+            bucket.granted.store(0);
+            bucket.throttled.store(0);
+            return writer;
+        }
+    }
+    return -1;
+}
+
+void SharedObject::detachWriter(int writer) {
+    writerBuckets[writer].pid.store(0, std::memory_order_release);
+}
+
+int SharedObject::takeTokens(int writer, int maxCount, uint64_t& waitMs) {
+    WriterBucket& bucket = writerBuckets[writer];
+    refill(bucket, monotonicMs());
+    int64_t tokens = bucket.tokens.load(std::memory_order_relaxed);
+    auto count = (int)std::min<int64_t>(maxCount, tokens / 1000);
+    if (count == 0) {
+        bucket.throttled.fetch_add(1, std::memory_order_relaxed);
+        // Pages per second are thousandths of a page per millisecond
+        uint64_t perMs = std::max<uint32_t>(1, bucket.rate.load(std::memory_order_relaxed));
+        waitMs = std::min<uint64_t>(50, std::max<uint64_t>(1, (1000 - tokens) / perMs));
+        return 0;
+    }
+    bucket.tokens.store(tokens - count * 1000, std::memory_order_relaxed);
+    bucket.granted.fetch_add(count, std::memory_order_relaxed);
+    return count;
+}
+
+void SharedObject::chargeTokens(int writer, int count) {
+    WriterBucket& bucket = writerBuckets[writer];
+    bucket.tokens.fetch_sub(count * 1000, std::memory_order_relaxed);
+    bucket.granted.fetch_add(count, std::memory_order_relaxed);
+}
+
+void SharedObject::refundTokens(int writer, int count) {
+    WriterBucket& bucket = writerBuckets[writer];
+    bucket.tokens.fetch_add(count * 1000, std::memory_order_relaxed);
+    bucket.granted.fetch_sub(count, std::memory_order_relaxed);
+}
+
+bool SharedObject::overBudget(int writer) {
+    WriterBucket& bucket = writerBuckets[writer];
+    refill(bucket, monotonicMs());
+    return bucket.tokens.load(std::memory_order_relaxed) < 1000;
+}
+
+const WriterBucket& SharedObject::writerBucket(int writer) const {
+    return writerBuckets[writer];
+}
+
+uint64_t SharedObject::takeTicket(bool isChit) {
+    TicketLine* line = isChit ? readerLine : writerLine;
+    uint64_t ticket = line->next.fetch_add(1);
+    line->owners[ticket % TICKET_OWNERS].store(processId(), std::memory_order_relaxed);
+    return ticket;
+}
+
+bool SharedObject::isTurn(bool isChit, uint64_t ticket) const {
+    TicketLine* line = isChit ? readerLine : writerLine;
+    // Past it too, when a reclaim pass skipped a turn ahead of us
+    return line->serving.load(std::memory_order_acquire) >= ticket;
+}
+
+void SharedObject::passTurn(bool isChit, uint64_t ticket) {
+    TicketLine* line = isChit ? readerLine : writerLine;
+    line->owners[ticket % TICKET_OWNERS].store(0, std::memory_order_relaxed);
+    uint64_t next = ticket + 1;
+    while (true) {
+        uint64_t serving = line->serving.load();
+        while (serving < next && !line->serving.compare_exchange_weak(serving, next)) {
+        }
+        // A waiter that leaves after this look sees its turn and passes it itself, see leaveLine.
+        // One that left before is ours to pass, the mark goes to whichever of us takes it first.
+        uint32_t left = LEFT_LINE;
+        if (next >= line->next.load() || !line->owners[next % TICKET_OWNERS].compare_exchange_strong(left, 0)) {
+            return;
+        }
+        ++next;
+    }
+}
+
+void SharedObject::leaveLine(bool isChit, uint64_t ticket) {
+    TicketLine* line = isChit ? readerLine : writerLine;
+    std::atomic<uint32_t>& owner = line->owners[ticket % TICKET_OWNERS];
+    owner.store(LEFT_LINE);
+    // Whoever passed the turn to us may have looked before the mark was there, then it is ours to pass
+    uint32_t left = LEFT_LINE;
+    if (isTurn(isChit, ticket) && owner.compare_exchange_strong(left, 0)) {
+        passTurn(isChit, ticket);
+    }
+}
+
+void SharedObject::countDrained(int pages) {
+    drainedPages->fetch_add(pages, std::memory_order_relaxed);
+}
+
+PageState SharedObject::pageState(int page) const {
+    return slot(page).state.load(std::memory_order_relaxed);
+}
+
+uint32_t SharedObject::pageOwner(int page) const {
+    return holderPid(slot(page).holder.load(std::memory_order_relaxed));
+}
+
+uint64_t SharedObject::pageSequence(int page) const {
+    return slot(page).sequence;
+}
+
+PageMeta& SharedObject::pageMeta(int page) {
+    return slot(page).meta;
+}
+
+std::atomic<uint32_t>& SharedObject::assembly() {
+    return *assemblyLock;
+}
+
+EventWord* SharedObject::assemblyEvent() {
+    return assemblyWaiters;
+}
+
+uint64_t SharedObject::publishSnapshot(const void* data, uint32_t size) {
+    if (!snapshot) {
+        return 0;
+    }
+    uint32_t self = processId();
+    for (int spins = 0;; ++spins) {
+        uint32_t expected = 0;
+        if (snapshot->writer.compare_exchange_weak(expected, self, std::memory_order_acquire, std::memory_order_relaxed)) {
+            break;
+        }
+        // Another writer is copying
+        if (spins % 64 == 63) {
+            std::this_thread::yield();
+        } else {
+            cpuRelax();
+        }
+    }
+    uint64_t version = snapshot->version.load(std::memory_order_relaxed);
+    snapshot->version.store(version + 1, std::memory_order_relaxed);
+    // A reader that sees any of the new bytes sees the odd version on its second look
+    std::atomic_thread_fence(std::memory_order_release);
+    snapshot->length = size;
+    std::memcpy(snapshot->data(), data, size);
+    snapshot->version.store(version + 2, std::memory_order_release);
+    snapshot->writer.store(0, std::memory_order_release);
+    return version / 2 + 1;
+}
+
+uint64_t SharedObject::readSnapshot(void* data, uint32_t capacity, uint32_t& size, uint64_t& retries) {
+    if (!snapshot) {
+        size = 0;
+        return 0;
+    }
+    for (int spins = 0;; ++spins) {
+        uint64_t version = snapshot->version.load(std::memory_order_acquire);
+        if ((version & 1) == 0) {
+            // The length may be torn as well, it is only trusted once the version held
+            size = std::min(snapshot->length, header->snapshotSize);
+            std::memcpy(data, snapshot->data(), std::min(size, capacity));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (snapshot->version.load(std::memory_order_relaxed) == version) {
+                return version / 2;
+            }
+            ++retries;
+        }
+        // A writer preempted halfway needs the CPU more than we do
+        if (spins % 64 == 63) {
+            std::this_thread::yield();
+        } else {
+            cpuRelax();
+        }
+    }
+}
+
+uint64_t SharedObject::snapshotVersion() const {
+    return snapshot ? snapshot->version.load(std::memory_order_acquire) / 2 : 0;
+}
+
+void SharedObject::startPolling(bool isChit) {
+    PollSignal& poll = isChit ? *readerPoll : *writerPoll;
+    poll.pollers.fetch_add(1);
+    // A poller that died armed would keep the flag set for good
+    poll.armed.store(0);
+}
+
+void SharedObject::stopPolling(bool isChit) {
+    (isChit ? readerPoll : writerPoll)->pollers.fetch_sub(1);
+}
+
+bool SharedObject::pollSignalDue(bool isChit, uint64_t position) {
+    PollSignal& poll = isChit ? *readerPoll : *writerPoll;
+    // Pairs with the fence in disarmPoll: either the poller sees our pages or we see it disarmed
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (poll.pollers.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    bool plainRing = header->mode == PoolMode::Queue && !(isChit && header->stealing);
+    if (plainRing && position != NO_POSITION) {
+        // Pages ahead of ours still waiting: whoever pushed the first of them signaled already,
+        // and the poller takes everything after a wake-up
+        PageRing* ring = isChit ? readyPages : freePages;
+        if (ring->head.load() < position) {
+            return false;
+        }
+    }
+    return poll.armed.load(std::memory_order_relaxed) == 0 && poll.armed.exchange(1) == 0;
+}
+
+void SharedObject::disarmPoll(bool isChit) {
+    (isChit ? readerPoll : writerPoll)->armed.store(0);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+size_t SharedObject::layout(uintptr_t base, const PoolGeometry& geometry) {
+    int pagesCount = geometry.pagesCount;
+    // Every block starts on its own cache line
+    size_t offset = 0;
+    auto carve = [&](size_t size) {
+        auto block = (void*)(base + offset);
+        offset += alignUp(size, CACHE_LINE);
+        return block;
+    };
+    header = (PoolHeader*)carve(sizeof(PoolHeader));
+    freePages = (PageRing*)carve(PageRing::bytes(pagesCount));
+    readyPages = (PageRing*)carve(PageRing::bytes(pagesCount));
+    freeEvent = (EventWord*)carve(sizeof(EventWord));
+    readyEvent = (EventWord*)carve(sizeof(EventWord));
+    assemblyLock = (std::atomic<uint32_t>*)carve(sizeof(std::atomic<uint32_t>));
+    assemblyWaiters = (EventWord*)carve(sizeof(EventWord));
+    claimCursor = (std::atomic<uint64_t>*)carve(sizeof(std::atomic<uint64_t>));
+    leaseCounter = (std::atomic<uint32_t>*)carve(sizeof(std::atomic<uint32_t>));
+    readerCursors = (ReaderCursor*)carve(MAX_READERS * sizeof(ReaderCursor));
+    processes = (ProcessSlot*)carve(MAX_PROCESSES * sizeof(ProcessSlot));
+    writerBuckets = (WriterBucket*)carve(MAX_WRITERS * sizeof(WriterBucket));
+    // Bumped by readers, read by writers, so apart from everything else
+    drainedPages = (std::atomic<uint64_t>*)carve(sizeof(std::atomic<uint64_t>));
+    drainSample = (DrainSample*)carve(sizeof(DrainSample));
+    writerLine = (TicketLine*)carve(sizeof(TicketLine));
+    readerLine = (TicketLine*)carve(sizeof(TicketLine));
+    readerPoll = (PollSignal*)carve(sizeof(PollSignal));
+    writerPoll = (PollSignal*)carve(sizeof(PollSignal));
+    commitCounter = (std::atomic<uint64_t>*)carve(sizeof(std::atomic<uint64_t>));
+    queueCount = (std::atomic<uint32_t>*)carve(sizeof(std::atomic<uint32_t>));
+    if (geometry.stealing) {
+        queueStride = alignUp(sizeof(ReaderQueue) + PageRing::bytes(std::min(pagesCount, QUEUE_PAGES)), CACHE_LINE);
+        queues = (char*)carve(MAX_READERS * queueStride);
+    }
+    if (geometry.snapshotSize > 0) {
+        snapshot = (SnapshotSlot*)carve(sizeof(SnapshotSlot) + geometry.snapshotSize);
+    }
+    return offset;
+}
+
+size_t SharedObject::headerStride(const PoolGeometry& geometry) {
+    return geometry.packedHeaders ? sizeof(PageHeader) : alignUp(sizeof(PageHeader), CACHE_LINE);
+}
+
+PageHeader& SharedObject::slot(int page) const {
+    return *(PageHeader*)(slots + page * slotStride);
+}
+
+uint32_t SharedObject::newLease() {
+    return leaseCounter->fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void SharedObject::hold(PageHeader& page, uint32_t owner, uint32_t lease, uint64_t now) {
+    page.holder.store(holderWord(owner, lease), std::memory_order_relaxed);
+    page.leaseTime.store(now, std::memory_order_relaxed);
+    page.state.store(PageState::Busy, std::memory_order_relaxed);
+}
+
+bool SharedObject::giveUp(PageHeader& page, uint32_t lease) {
+    // A claim, not a check: a reclaim pass may be taking the page at the same moment
+    uint64_t expected = holderWord(processId(), lease);
+    return page.holder.compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+}
+
+bool SharedObject::ownerGone(uint32_t pid, uint64_t since, uint64_t staleMs, uint64_t now) const {
+    if (pid == processId()) {
+        return false;
+    }
+    if (!processAlive(pid)) {
+        return true;
+    }
+    if (staleMs == 0 || now - since < staleMs) {
+        return false;
+    }
+    // Alive but silent: only stale if its heartbeat is as old as the lease
+    for (int process = 0; process < MAX_PROCESSES; ++process) {
+        if (processes[process].pid.load() == pid) {
+            return now - processes[process].heartbeat.load() >= staleMs;
+        }
+    }
+    return true;
+}
+
+void SharedObject::refill(WriterBucket& bucket, uint64_t now) {
+    const uint64_t DRAIN_WINDOW_MS = 100;
+    const uint64_t ACTIVE_MS = 1000;
+
+    uint64_t sampled = drainSample->time.load();
+    if (now - sampled >= DRAIN_WINDOW_MS && drainSample->time.compare_exchange_strong(sampled, now)) {
+        uint64_t drained = drainedPages->load();
+        auto fresh = (uint32_t)((drained - drainSample->drained.load()) * 1000 / (now - sampled));
+        drainSample->drained.store(drained);
+        // Smoothed, the very first window has no history yet
+        uint32_t previous = drainSample->rate.load();
+        drainSample->rate.store(sampled == 0 ? 0 : previous == 0 ? fresh : (previous + fresh) / 2);
+        uint32_t writers = 0;
+        for (int writer = 0; writer < MAX_WRITERS; ++writer) {
+            if (writerBuckets[writer].pid.load() != 0 && now - writerBuckets[writer].lastRefill.load() < ACTIVE_MS) {
+                ++writers;
+            }
+        }
+        drainSample->writers.store(writers);
+    }
+
+    uint64_t elapsed = now - bucket.lastRefill.load(std::memory_order_relaxed);
+    bucket.lastRefill.store(now, std::memory_order_relaxed);
+    uint32_t pagesCount = header->pagesCount;
+    uint32_t used = pagesCount - std::min(pagesCount, freePages->size());
+    uint32_t writers = std::max<uint32_t>(1, drainSample->writers.load());
+    // A fair share of what readers drain: twice that while the pool has room, less once it is nearly full
+    uint32_t share = drainSample->rate.load() / writers;
+    uint32_t rate = std::max<uint32_t>(1, used * 10 >= pagesCount * 9 ? share * 3 / 4 : share * 2);
+    // Enough for 10 ms, so that sleeping for a millisecond never caps the rate
+    int64_t burst = std::max<int64_t>({1, pagesCount / writers, rate / 100}) * 1000;
+    if (used * 2 < pagesCount) {
+        // Plenty of free pages, nobody is starved yet
+        bucket.rate.store(0, std::memory_order_relaxed);
+        bucket.tokens.store(burst, std::memory_order_relaxed);
+        return;
+    }
+    bucket.rate.store(rate, std::memory_order_relaxed);
+    int64_t tokens = bucket.tokens.load(std::memory_order_relaxed) + (int64_t)(rate * elapsed);
+    bucket.tokens.store(std::min(tokens, burst), std::memory_order_relaxed);
+}
@@ -0,0 +1,397 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include "EventCount.h"
+
+static const uint32_t POOL_MAGIC = 0x53504843; // "CHPS"
+static const uint32_t POOL_VERSION = 17;
+
+// Upper bound on broadcast subscribers, each one owns a cursor slot in the control block
+static const int MAX_READERS = 64;
+// Processes that keep a heartbeat at the same time, more still work but can only be reclaimed once dead
+static const int MAX_PROCESSES = 64;
+// Writers with a token bucket at the same time, the rest write unthrottled
+static const int MAX_WRITERS = 64;
+// Work-stealing pools: capacity of each reader's queue, commits that do not fit go to the shared ring
+static const int QUEUE_PAGES = 64;
+
+enum class PoolMode : uint32_t {
+    // Every page goes to exactly one reader
+    Queue = 0,
+    // Every reader sees every page, a page is recycled once the slowest reader passed it
+    Broadcast,
+};
+
+// Who goes next when several workers wait for pages, chosen by whoever creates the pool
+enum class Fairness : uint32_t {
+    // Whoever gets there first, the cheapest
+    Race = 0,
+    // Strict arrival order among the writers and among the readers
+    Fifo,
+    // The preferred side waits less. An event loop tries its tasks last on every pass, so they find
+    // what the other side just handed back. Blocking waiters of that side spin before parking
+    // while the other side's park straight away, which only matters with more than one core.
+    ReaderPriority,
+    WriterPriority,
+};
+
+// Command line names: race, fifo, readers, writers
+const char* fairnessName(Fairness fairness);
+bool parseFairness(const std::string& name, Fairness& fairness);
+
+struct PoolGeometry {
+    int pagesCount = 12;
+    int pageSize = 4*1024;
+    PoolMode mode = PoolMode::Queue;
+    // Per-writer token buckets sized from the reader drain rate, queue mode only
+    bool budgets = false;
+    Fairness fairness = Fairness::Race;
+    // Per-reader ready queues, writers fill the least loaded one and idle readers steal. Queue mode only,
+    // a reader then no longer gets pages in commit order.
+    bool stealing = false;
+    // Writers seal every page with a CRC32C of its payload, readers check it along with the sequence numbers
+    bool checksums = false;
+    // Records written with RecordWriter::write are LZ compressed page by page, queue mode only
+    bool compression = false;
+    // Bytes of the latest-value slot next to the rings, see PagePool::publish. Zero leaves it out.
+    int snapshotSize = 0;
+    // Page headers packed several to a cache line instead of one line each. The layout before
+    // per-page headers, for comparison.
+    bool packedHeaders = false;
+
+    // Keeps page payloads cache-line aligned and the counts within what the rings can hold
+    PoolGeometry normalized() const;
+};
+
+enum class PageState : uint8_t {
+    CanWrite = 0,
+    Busy,
+    CanRead
+};
+
+// Lives in shared memory, so the atomics must be plain lock-free words that start zeroed
+static_assert(std::atomic<PageState>::is_always_lock_free, "page states must be lock-free");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring positions must be lock-free");
+static_assert(sizeof(std::atomic<PageState>) == sizeof(PageState), "page states must be plain bytes");
+
+// Versioned header at the start of the shared mapping, late joiners take the geometry from here
+struct PoolHeader {
+    std::atomic<uint32_t> initState;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pagesCount;
+    uint32_t pageSize;
+    PoolMode mode;
+    uint32_t budgets;
+    Fairness fairness;
+    uint32_t stealing;
+    uint32_t checksums;
+    uint32_t compression;
+    uint32_t snapshotSize;
+    uint32_t packedHeaders;
+    // Boot the pool was created or last recovered in, see bootId. Opened in a later one, a persisted
+    // pool forgets every owner it recorded: their pids may belong to anyone by now.
+    uint64_t bootId;
+};
+
+// Broadcast reader position: the next sequence number it will read
+struct alignas(64) ReaderCursor {
+    std::atomic<uint64_t> next;
+    std::atomic<uint32_t> active;
+    std::atomic<uint32_t> pid;
+};
+
+// Liveness of a process using the pool, monotonic milliseconds of its last pool operation
+struct alignas(64) ProcessSlot {
+    std::atomic<uint32_t> pid;
+    std::atomic<uint64_t> heartbeat;
+};
+
+// Token bucket of one writer, in thousandths of a page. Only its owner changes it,
+// the counters are there for anyone looking for the writer that overproduces.
+struct alignas(64) WriterBucket {
+    std::atomic<uint32_t> pid;
+    std::atomic<int64_t> tokens;
+    std::atomic<uint64_t> lastRefill;
+    // Pages per second it may write right now
+    std::atomic<uint32_t> rate;
+    std::atomic<uint64_t> granted;
+    std::atomic<uint64_t> throttled;
+};
+
+// Reader drain rate in pages per second, resampled by whichever writer refills first
+struct alignas(64) DrainSample {
+    std::atomic<uint64_t> time;
+    std::atomic<uint64_t> drained;
+    std::atomic<uint32_t> rate;
+    std::atomic<uint32_t> writers;
+};
+
+// Arrival order of one side's waiters for Fairness::Fifo. The owners let a reclaim pass
+// skip the turn of a process that died waiting in line.
+static const int TICKET_OWNERS = 256;
+struct alignas(64) TicketLine {
+    std::atomic<uint64_t> next;
+    alignas(64) std::atomic<uint64_t> serving;
+    std::atomic<uint32_t> owners[TICKET_OWNERS];
+};
+
+// What a reclaim pass got back from dead or stalled processes
+struct Reclaimed {
+    // Back in the free ring
+    int freePages = 0;
+    // Broadcast slots published empty so writers can lap them
+    int publishedPages = 0;
+    int readers = 0;
+    // Turns skipped in the Fifo lines
+    int turns = 0;
+    bool assembly = false;
+    // A latest-value writer that died holding the slot, a copy it cut short is published empty
+    bool snapshot = false;
+
+    int total() const { return freePages + publishedPages + readers + turns + (assembly ? 1 : 0) + (snapshot ? 1 : 0); }
+};
+
+// Bounded multi-producer/multi-consumer ring of page indices (Vyukov's queue).
+// The position a page is pushed at is its global sequence number, pops come out in push order.
+// Batches take consecutive positions with a single claim. The cells follow the struct in shared memory.
+struct PageRing {
+    struct Cell {
+        std::atomic<uint64_t> sequence;
+        int32_t page;
+    };
+
+    uint32_t capacity;
+    // Producers and consumers each get a line of their own
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) std::atomic<uint64_t> head;
+
+    static size_t bytes(int capacity);
+    // Pages in the ring, a snapshot
+    uint32_t size() const;
+
+    void init(int ringCapacity);
+    // All or nothing, position is where the first page went
+    bool tryPush(const int* pages, int count, uint64_t& position);
+    // Takes up to maxCount published pages, returns how many
+    int tryPop(int* pages, int maxCount, uint64_t& position);
+
+private:
+    Cell* cells();
+};
+
+// Owner of a reader's ready queue in work-stealing pools, the ring follows on the next line.
+// Pages left behind by a reader that is gone get stolen like any others.
+struct alignas(64) ReaderQueue {
+    std::atomic<uint32_t> pid;
+};
+
+// Latest-value slot, a seqlock: the version is odd while a writer copies, the data follows on the next line.
+// Readers never write to the slot.
+struct alignas(64) SnapshotSlot {
+    std::atomic<uint64_t> version;
+    // Writers take turns by putting their pid here before they touch the version,
+    // so a reclaim can always finish the turn of a dead one
+    std::atomic<uint32_t> writer;
+    uint32_t length;
+
+    char* data() { return (char*)(this + 1); }
+};
+
+// Pollable readiness of one side, see PagePool::pollHandle. Only the first release after the
+// pollers reset signals them, the flag coalesces every release in between.
+struct alignas(64) PollSignal {
+    // Processes that registered a descriptor for this side
+    std::atomic<uint32_t> pollers;
+    std::atomic<uint32_t> armed;
+};
+
+// Payload bytes used in a page and the next page of the same record, -1 ends the chain.
+// Only the head page of a multi-page record goes through the ready ring.
+struct PageMeta {
+    uint32_t length;
+    int32_t next;
+    // CRC32C of the used payload, in pools with checksums
+    uint32_t checksum;
+    // Decoded size of a compressed page, zero when the payload is stored as is
+    uint32_t rawLength;
+};
+
+// Per-page control data, in a table behind the payloads. Each one is padded to a cache line of its own,
+// so claiming one page never invalidates the line another worker is using for its page, while the
+// payloads stay page aligned and back to back.
+struct PageHeader {
+    std::atomic<PageState> state;
+    // Process holding the page in the low half, zero while the page sits in a ring. The high half is the
+    // lease number it holds the page under, a new one on every take and reclaim.
+    std::atomic<uint64_t> holder;
+    // Monotonic milliseconds when the owner took it
+    std::atomic<uint64_t> leaseTime;
+    // Global sequence number of the last commit
+    uint64_t sequence;
+    // Broadcast: sequence + 1 of what the page holds, zero while it was never published
+    std::atomic<uint64_t> published;
+    PageMeta meta;
+};
+
+// Process-local view of the control block in the shared mapping
+class SharedObject {
+public:
+    explicit SharedObject(void* mapView);
+
+    static size_t bytes(const PoolGeometry& geometry);
+
+    // The first process to map the block writes the header and fills the free ring,
+    // the rest wait for it. Returns false if the block was made by an incompatible version.
+    // The creator publishes the block only in attachPages, once the page headers are reset too.
+    bool init(bool created, const PoolGeometry& geometry);
+
+    // The page mapping: a header followed by the payload for every page
+    static size_t pagesBytes(const PoolGeometry& geometry);
+    void attachPages(void* pagesView);
+    char* payload(int page);
+
+    PoolGeometry geometry() const;
+
+    // Pages are taken under a lease number, the whole batch and the chains behind record heads under
+    // one. Handing them back takes the same number: once a page was reclaimed it is lost to the old
+    // lease even if the same process has taken it again since.
+    // Readers of work-stealing pools pass their queue, see joinQueue
+    int takePages(bool isChit, int* pages, int maxCount, uint32_t& lease, int queue = -1);
+    uint64_t returnPages(const int* pages, int count, bool isChit, uint32_t lease);
+
+    // Work-stealing pools: takes a reader queue for this reader, -1 when all are taken.
+    // Readers without a queue still get pages from the shared ring and by stealing.
+    int joinQueue();
+    void leaveQueue(int queue);
+
+    // Broadcast mode, Disruptor style: sequence s lives in page s % pagesCount.
+    // Writers claim consecutive sequences and are gated by the slowest active reader.
+    int subscribe();
+    void unsubscribe(int reader);
+    int claimSlots(int* pages, int maxCount, uint32_t& lease);
+    void publishSlots(const int* pages, int count, uint32_t lease);
+    // Published pages from sequence "from" on, without consuming them
+    int readSlots(uint64_t from, int* pages, int maxCount);
+    void advanceCursor(int reader, uint64_t next);
+    uint64_t readerNext(int reader) const;
+
+    // Readers wait on the ready ring's event, writers on the free ring's
+    EventWord* pageEvent(bool isChit);
+
+    PageState pageState(int page) const;
+    uint32_t pageOwner(int page) const;
+    // Chain pages after the head of a committed record: no owner until a reader takes the head
+    void handOver(const int* pages, int count, uint32_t lease);
+    uint64_t pageSequence(int page) const;
+    PageMeta& pageMeta(int page);
+
+    // Only one writer at a time may assemble a multi-page record, otherwise
+    // several half-built records could hold every page and wait on each other
+    // Holds the pid of the assembling process, zero when free
+    std::atomic<uint32_t>& assembly();
+    EventWord* assemblyEvent();
+
+    // Finds or takes the heartbeat slot of this process, -1 when the table is full
+    int attachProcess();
+    void heartbeat(int process);
+    // Takes back pages, cursors and the assembly lock from dead processes. With staleMs above zero
+    // also from live ones whose lease and heartbeat are older than that; such a process loses its
+    // pages even if it wakes up later, its releases of them are ignored then.
+    Reclaimed reclaim(uint64_t staleMs);
+
+    // Budgets: a writer takes up to maxCount tokens, zero when it is over budget, and then
+    // waitMs says when to try again. Unused tokens go back with refundTokens.
+    int attachWriter();
+    void detachWriter(int writer);
+    int takeTokens(int writer, int maxCount, uint64_t& waitMs);
+    void refundTokens(int writer, int count);
+    // Takes pages on credit, the debt delays later takes
+    void chargeTokens(int writer, int count);
+    bool overBudget(int writer);
+    const WriterBucket& writerBucket(int writer) const;
+    // Fifo fairness: a waiter takes a ticket and may only take pages on its turn
+    uint64_t takeTicket(bool isChit);
+    bool isTurn(bool isChit, uint64_t ticket) const;
+    void passTurn(bool isChit, uint64_t ticket);
+    // Gives up a ticket before its turn, the turn is passed on as soon as it comes
+    void leaveLine(bool isChit, uint64_t ticket);
+
+    // Readers count what they hand back, that is the drain rate writers are budgeted from
+    void countDrained(int pages);
+
+    // Latest-value slot. Publishing only ever waits for another writer's copy, never for readers.
+    // Reading copies optimistically and retries until no writer got in between, counting the retries.
+    // Both return the number of the snapshot, zero before the first one or without a slot.
+    uint64_t publishSnapshot(const void* data, uint32_t size);
+    uint64_t readSnapshot(void* data, uint32_t capacity, uint32_t& size, uint64_t& retries);
+    uint64_t snapshotVersion() const;
+
+    // Readiness notifications for the side waiting on isChit pages. A release that fed that side
+    // asks pollSignalDue whether it has to signal: only with pollers registered, only on the first
+    // release since they last disarmed, and for plain queue rings only when the ring was empty before
+    // the page at position went in. NO_POSITION skips the ring check.
+    static const uint64_t NO_POSITION = UINT64_MAX;
+    void startPolling(bool isChit);
+    void stopPolling(bool isChit);
+    bool pollSignalDue(bool isChit, uint64_t position = NO_POSITION);
+    void disarmPoll(bool isChit);
+
+private:
+    // Points the members into the block at base, returns its total size
+    size_t layout(uintptr_t base, const PoolGeometry& geometry);
+    PageHeader& slot(int page) const;
+    static size_t headerStride(const PoolGeometry& geometry);
+    uint32_t newLease();
+    void hold(PageHeader& page, uint32_t owner, uint32_t lease, uint64_t now);
+    // Hands a page back to a ring or to readers only if it is still held under that lease
+    bool giveUp(PageHeader& page, uint32_t lease);
+    void refill(WriterBucket& bucket, uint64_t now);
+    // Commits to the least loaded reader queue, the shared ring when none has room
+    uint64_t queuePages(const int* pages, int count);
+    // Own queue first, then the shared ring, then half of the fullest other queue
+    int takeQueued(int queue, int* pages, int maxCount, uint64_t& position);
+    ReaderQueue& readerQueue(int queue) const;
+    PageRing& queueRing(int queue) const;
+    bool ownerGone(uint32_t pid, uint64_t since, uint64_t staleMs, uint64_t now) const;
+    // Puts a page this process just took over from its holder back where it belongs
+    void takeBack(int page, uint32_t lease, Reclaimed& result);
+    // After a reboot: every page, slot, ticket, lock and cursor recorded is held by no one
+    void forgetOwners();
+
+    PoolHeader* header;
+    char* slots;
+    size_t slotStride;
+    char* payloads;
+    bool initializing;
+    // Joined a persisted pool left by an earlier boot, attachPages recovers it
+    bool rebooted;
+    PageRing* freePages;
+    PageRing* readyPages;
+    EventWord* freeEvent;
+    EventWord* readyEvent;
+    std::atomic<uint32_t>* assemblyLock;
+    EventWord* assemblyWaiters;
+    std::atomic<uint64_t>* claimCursor;
+    std::atomic<uint32_t>* leaseCounter;
+    ReaderCursor* readerCursors;
+    ProcessSlot* processes;
+    WriterBucket* writerBuckets;
+    std::atomic<uint64_t>* drainedPages;
+    DrainSample* drainSample;
+    TicketLine* writerLine;
+    TicketLine* readerLine;
+    // Work-stealing pools: commit sequence numbers and the queues, the queue count is how far anyone looks
+    std::atomic<uint64_t>* commitCounter;
+    std::atomic<uint32_t>* queueCount;
+    char* queues;
+    size_t queueStride;
+    // Null in pools without a snapshot size
+    SnapshotSlot* snapshot;
+    PollSignal* readerPoll;
+    PollSignal* writerPoll;
+};
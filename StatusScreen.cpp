@@ -5,6 +5,7 @@
 #include "utils.h"
 
 static const int PROGRESS_MAX = 12;
+static const int PAGE_ROWS = 12;
 
 std::wstring arrow(int i, int w) {
     std::wstring result(w, L' ');
@@ -18,25 +19,29 @@ std::wstring arrow(int i, int w) {
     return result;
 }
 
-StatusScreen::StatusScreen(bool isChit, int number, int waitMs)
+StatusScreen::StatusScreen(bool isChit, int number, int waitMs, int pagesCount, int workers)
     : isChit(isChit)
     , number(number)
-    , state(State::Inactive)
-    , activePage(0)
-    , stateProgress(0)
+    , workers(std::max(1, workers))
+    , pagesCount(pagesCount)
+    , firstPage(0)
     , waitMs(waitMs)
-    , arrowTick(0)
 {
     updateLines();
 }
 
-void StatusScreen::updateState(State s, int page, float progress) {
-    state = s;
-    activePage = page;
-    stateProgress = progress;
+void StatusScreen::updateState(int worker, State s, int page, float progress) {
+    WorkerState& current = workers[worker];
+    current.state = s;
+    current.page = page;
+    // Scroll the page column so the active page stays visible
+    if (page >= 0 && (page < firstPage || page >= firstPage + PAGE_ROWS)) {
+        firstPage = clamp(0, page - PAGE_ROWS / 2, std::max(0, pagesCount - PAGE_ROWS));
+    }
+    current.progress = progress;
     waitMs = 0;
     if (progress == 0) {
-        arrowTick = 0;
+        current.arrowTick = 0;
     }
     updateLines();
 }
@@ -46,31 +51,57 @@ void StatusScreen::updateWait(int wait) {
     updateLines();
 }
 
+void StatusScreen::setPagesCount(int count) {
+    pagesCount = count;
+    firstPage = 0;
+    updateLines();
+}
+
+int StatusScreen::pageDigits(int pagesCount) {
+    return std::max(2, (int)std::to_wstring(pagesCount - 1).size());
+}
+
 void StatusScreen::tickAnim() {
-    ++arrowTick;
+    for (WorkerState& worker : workers) {
+        ++worker.arrowTick;
+    }
 }
 
 void StatusScreen::drawOn(Screen& s) {
     lines.drawOn(s, {0, 0, s.w(), s.h()});
-    Rect lineNum{15, 0, 2, 1};
-    for (int page = 0; page < 12; ++page) {
+    SHORT digits = pageDigits(pagesCount);
+    Rect lineNum{15, 0, digits, 1};
+    bool waiting = false;
+    for (const WorkerState& worker : workers) {
+        waiting = waiting || worker.state == State::Waiting;
+    }
+    for (int row = 0; row < PAGE_ROWS && firstPage + row < pagesCount; ++row) {
         WORD fg = FG::DARK_GREY;
-        if (page == activePage) {
+        if (const WorkerState* worker = pageWorker(firstPage + row)) {
             fg = FG::WHITE;
-            int progressValue = roundI(stateProgress * PROGRESS_MAX);
+            int progressValue = roundI(worker->progress * PROGRESS_MAX);
             progressValue = clamp(0, progressValue, PROGRESS_MAX);
             WORD progressColor = BG::DARK_GREEN;
-            s.paintRect(lineNum.moved(3, page).withW(PROGRESS_MAX), FG::WHITE | BG::DARK_GREY, false);
-            s.paintRect(lineNum.moved(3, page).withW(progressValue), FG::WHITE | progressColor, false);
+            s.paintRect(lineNum.moved(digits + 1, row).withW(PROGRESS_MAX), FG::WHITE | BG::DARK_GREY, false);
+            s.paintRect(lineNum.moved(digits + 1, row).withW(progressValue), FG::WHITE | progressColor, false);
         }
-        s.paintRect(lineNum.moved(0, page), fg | BG::BLACK, false);
+        s.paintRect(lineNum.moved(0, row), fg | BG::BLACK, false);
     }
-    if (state == State::Waiting) {
+    if (waiting) {
         s.paintRect({2, 3, 10, 1}, FG::WHITE | BG::DARK_RED, false);
     }
     s.paintRect({2, 10, 10, 1}, FG::BLACK | BG::GREY, false);
 }
 
+const StatusScreen::WorkerState* StatusScreen::pageWorker(int page) const {
+    for (const WorkerState& worker : workers) {
+        if (worker.page == page && (worker.state == State::Reading || worker.state == State::Writing)) {
+            return &worker;
+        }
+    }
+    return nullptr;
+}
+
 void StatusScreen::updateLines() {
     std::wstring chitPis = isChit ? L"ЧИТАТЕЛЬ" : L"ПИСАТЕЛЬ";
     std::wstring num = align(std::to_wstring(number), 2);
@@ -78,21 +109,32 @@ void StatusScreen::updateLines() {
     std::wstring empty(14, L' ');
     std::wstring emptyMid = empty + L"│";
 
+    int waiting = 0;
+    for (const WorkerState& worker : workers) {
+        waiting += worker.state == State::Waiting;
+    }
+    std::wstring workerCount = emptyMid;
+    if (workers.size() > 1) {
+        workerCount = L"   ЗАДАЧ: " + align(std::to_wstring(workers.size()), 3) + L" │";
+    }
     std::wstring waitComment = emptyMid;
     std::wstring waitTime = emptyMid;
-    if (state == State::Inactive) {
+    if (workers.front().state == State::Inactive) {
         waitComment = L" старт через: │";
         if (waitMs > 0) {
             waitTime = align(std::to_wstring(waitMs), 7, false) + L" мсек  │";
         }
-    } else if (state == State::Waiting) {
+    } else if (waiting > 0) {
         waitComment = L"   ОЖИДАНИЕ   │";
+        if (workers.size() > 1) {
+            waitTime = align(std::to_wstring(waiting) + L" из " + std::to_wstring(workers.size()), 14, false) + L"│";
+        }
     }
 
     std::vector<std::wstring> rows = {
             empty + L"┌",
             L" " + chitPis + L" №" + num + L" │",
-            emptyMid,
+            workerCount,
             waitComment,
             waitTime,
             emptyMid,
@@ -103,15 +145,15 @@ void StatusScreen::updateLines() {
             L"  F10  Выход  │",
             empty + L"└",
     };
-    for (int page = 0; page < 12; ++page) {
-        rows[page] += align(std::to_wstring(page), 2, false, L'0');
-        if (activePage == page) {
-            if (state == State::Reading) {
-                rows[page] += L" " + arrow(arrowTick, 5) + L"ЧТЕНИЕ";
-                continue;
-            } else if (state == State::Writing) {
-                rows[page] += L"  ЗАПИСЬ" + arrow(arrowTick, 5);
-                continue;
+    int digits = pageDigits(pagesCount);
+    for (int row = 0; row < PAGE_ROWS && firstPage + row < pagesCount; ++row) {
+        int page = firstPage + row;
+        rows[row] += align(std::to_wstring(page), digits, false, L'0');
+        if (const WorkerState* worker = pageWorker(page)) {
+            if (worker->state == State::Reading) {
+                rows[row] += L" " + arrow(worker->arrowTick, 5) + L"ЧТЕНИЕ";
+            } else {
+                rows[row] += L"  ЗАПИСЬ" + arrow(worker->arrowTick, 5);
             }
         }
     }
@@ -2,6 +2,8 @@
 
 #include "Lines.h"
 
+#include <vector>
+
 enum class State {
     Inactive,
     Reading,
@@ -9,25 +11,37 @@ enum class State {
     Waiting,
 };
 
+// One screen for all workers of the process, with a state line for each
 class StatusScreen {
 public:
-    StatusScreen(bool isChit, int number, int waitMs);
+    StatusScreen(bool isChit, int number, int waitMs, int pagesCount, int workers = 1);
+
+    static int pageDigits(int pagesCount);
 
-    void updateState(State s, int page = -1, float progress = 0);
+    void updateState(int worker, State s, int page = -1, float progress = 0);
     void updateWait(int wait);
+    void setPagesCount(int count);
     void tickAnim();
 
     void drawOn(Screen& s);
 
 private:
+    struct WorkerState {
+        State state = State::Inactive;
+        int page = -1;
+        float progress = 0;
+        int arrowTick = 0;
+    };
+
     void updateLines();
+    // The worker on the page, null when the page is idle
+    const WorkerState* pageWorker(int page) const;
 
     bool isChit;
     int number;
-    State state;
-    int activePage;
-    float stateProgress;
+    std::vector<WorkerState> workers;
+    int pagesCount;
+    int firstPage;
     int waitMs;
-    int arrowTick;
     Lines lines;
 };
@@ -0,0 +1,236 @@
+#include "affinity.h"
+
+#include <thread>
+#include <cstdlib>
+#include <cstdint>
+
+#ifdef _WIN32
+// The Ex processor and NUMA queries are Windows 7 and up
+#if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0601
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <fstream>
+#endif
+
+namespace {
+
+#ifndef _WIN32
+// Straight from <numaif.h>, so there is no dependency on libnuma
+const int MPOL_PREFERRED = 1;
+const unsigned MPOL_MF_MOVE = 1 << 1;
+#endif
+
+size_t osPageSize() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+}
+
+std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> cpus;
+    const char* pos = text.c_str();
+    while (*pos) {
+        char* end = nullptr;
+        long first = std::strtol(pos, &end, 10);
+        if (end == pos) {
+            break;
+        }
+        long last = first;
+        pos = end;
+        if (*pos == '-') {
+            last = std::strtol(pos + 1, &end, 10);
+            pos = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back((int)cpu);
+        }
+        while (*pos == ',' || *pos == '\n' || *pos == ' ') {
+            ++pos;
+        }
+    }
+    return cpus;
+}
+
+#ifdef _WIN32
+
+bool pinThread(const std::vector<int>& cpus) {
+    // Processor group 0 only, which is every CPU on machines with up to 64 of them
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < (int)sizeof(DWORD_PTR) * 8) {
+            mask |= (DWORD_PTR)1 << cpu;
+        }
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
+int numaNodes() {
+    ULONG highest = 0;
+    if (!GetNumaHighestNodeNumber(&highest)) {
+        return 1;
+    }
+    return (int)highest + 1;
+}
+
+std::vector<int> nodeCpus(int node) {
+    std::vector<int> cpus;
+    GROUP_AFFINITY affinity{};
+    if (GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) && affinity.Group == 0) {
+        for (int cpu = 0; cpu < (int)sizeof(KAFFINITY) * 8; ++cpu) {
+            if (affinity.Mask & ((KAFFINITY)1 << cpu)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
+
+int currentNode() {
+    PROCESSOR_NUMBER processor;
+    GetCurrentProcessorNumberEx(&processor);
+    USHORT node = 0;
+    if (!GetNumaProcessorNodeEx(&processor, &node)) {
+        return 0;
+    }
+    return node;
+}
+
+std::vector<int> pageNodes(const void* data, size_t size) {
+    size_t pageSize = osPageSize();
+    std::vector<PSAPI_WORKING_SET_EX_INFORMATION> info((size + pageSize - 1) / pageSize);
+    for (size_t i = 0; i < info.size(); ++i) {
+        info[i].VirtualAddress = (char*)data + i * pageSize;
+    }
+    std::vector<int> nodes(info.size(), -1);
+    if (!QueryWorkingSetEx(GetCurrentProcess(), info.data(), (DWORD)(info.size() * sizeof(info[0])))) {
+        return nodes;
+    }
+    for (size_t i = 0; i < info.size(); ++i) {
+        if (info[i].VirtualAttributes.Valid) {
+            nodes[i] = (int)info[i].VirtualAttributes.Node;
+        }
+    }
+    return nodes;
+}
+
+#else
+
+bool pinThread(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+int numaNodes() {
+    int nodes = 0;
+    while (std::ifstream("/sys/devices/system/node/node" + std::to_string(nodes) + "/cpulist")) {
+        ++nodes;
+    }
+    return nodes > 0 ? nodes : 1;
+}
+
+std::vector<int> nodeCpus(int node) {
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (!file) {
+        // No NUMA in the kernel, the single node has every CPU
+        std::vector<int> cpus;
+        for (int cpu = 0; node == 0 && cpu < (int)std::thread::hardware_concurrency(); ++cpu) {
+            cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+    std::string list;
+    std::getline(file, list);
+    return parseCpuList(list);
+}
+
+int currentNode() {
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return (int)node;
+}
+
+std::vector<int> pageNodes(const void* data, size_t size) {
+    size_t pageSize = osPageSize();
+    size_t count = (size + pageSize - 1) / pageSize;
+    std::vector<void*> pages(count);
+    for (size_t i = 0; i < count; ++i) {
+        pages[i] = (char*)data + i * pageSize;
+    }
+    // move_pages without target nodes only reports where the pages are
+    std::vector<int> status(count, -1);
+    std::vector<int> nodes(count, -1);
+    if (syscall(SYS_move_pages, 0, count, pages.data(), nullptr, status.data(), 0) != 0) {
+        return nodes;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        nodes[i] = status[i] >= 0 ? status[i] : -1;
+    }
+    return nodes;
+}
+
+#endif
+
+bool placeOnNode(const void* data, size_t size, int node) {
+    std::vector<int> cpus = nodeCpus(node);
+    if (cpus.empty()) {
+        return false;
+    }
+#ifndef _WIN32
+    // The shared segment keeps the policy, so pages faulted in later by anyone land there too
+    unsigned long mask[16] = {};
+    if (node >= (int)sizeof(mask) * 8) {
+        return false;
+    }
+    mask[node / (sizeof(long) * 8)] |= 1UL << (node % (sizeof(long) * 8));
+    auto begin = (uintptr_t)data & ~(uintptr_t)(osPageSize() - 1);
+    size_t length = (uintptr_t)data + size - begin;
+    if (syscall(SYS_mbind, begin, length, MPOL_PREFERRED, mask, sizeof(mask) * 8, MPOL_MF_MOVE) != 0) {
+        return false;
+    }
+#endif
+    // First touch from a CPU of the node, reads only since others may be using the pages already
+    bool pinned = false;
+    std::thread toucher([&]() {
+        pinned = pinThread(cpus);
+        size_t pageSize = osPageSize();
+        for (size_t offset = 0; offset < size; offset += pageSize) {
+            (void)*(volatile const char*)((const char*)data + offset);
+        }
+    });
+    toucher.join();
+    return pinned;
+}
+
+double remoteShare(const std::vector<int>& nodes, int node) {
+    int resident = 0;
+    int remote = 0;
+    for (int pageNode : nodes) {
+        if (pageNode >= 0) {
+            ++resident;
+            remote += pageNode != node;
+        }
+    }
+    return resident > 0 ? (double)remote / resident : 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Parses CPU lists like "0-3,8", the format Linux uses in /sys
+std::vector<int> parseCpuList(const std::string& text);
+
+// Restricts the calling thread to the given CPUs
+bool pinThread(const std::vector<int>& cpus);
+
+// One node on machines without NUMA
+int numaNodes();
+std::vector<int> nodeCpus(int node);
+// Node of the CPU the calling thread runs on right now
+int currentNode();
+
+// Prefers the node for the memory range and faults every page in from one of its CPUs.
+// Pages already resident elsewhere are migrated where the OS allows it (Linux).
+bool placeOnNode(const void* data, size_t size, int node);
+
+// Node of every OS page in the range, -1 for pages nothing has touched yet
+std::vector<int> pageNodes(const void* data, size_t size);
+
+// Share of the resident pages that live on another node than the given one
+double remoteShare(const std::vector<int>& nodes, int node);
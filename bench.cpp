@@ -0,0 +1,1595 @@
+#include "PagePool.h"
+#include "Options.h"
+#include "EventCount.h"
+#include "Semaphore.h"
+#include "pagecopy.h"
+#include "Records.h"
+#include "platform.h"
+#include "affinity.h"
+#include "checksum.h"
+#include "lz.h"
+#include "EventLoop.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <bit>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const int32_t POISON = -1;
+
+struct Stamp {
+    int32_t writer;
+    int32_t counter;
+};
+
+void stampPage(PageSpan page, Stamp stamp) {
+    for (size_t i = 0; i + sizeof(Stamp) <= page.size; i += sizeof(Stamp)) {
+        std::memcpy(page.data + i, &stamp, sizeof(Stamp));
+    }
+}
+
+bool checkPage(PageSpan page, Stamp& stamp) {
+    std::memcpy(&stamp, page.data, sizeof(Stamp));
+    for (size_t i = 0; i + sizeof(Stamp) <= page.size; i += sizeof(Stamp)) {
+        if (std::memcmp(page.data + i, &stamp, sizeof(Stamp)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Integrity runs fill the whole payload with a pattern derived from the stamp, so a page
+// that got bytes of another page or of an older lap of itself cannot pass the check
+uint64_t patternWord(Stamp stamp, size_t index) {
+    // splitmix64 finalizer
+    uint64_t x = ((uint64_t)(uint32_t)stamp.writer << 32 | (uint32_t)stamp.counter) + (index + 1) * 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+void patternPage(PageSpan page, Stamp stamp) {
+    std::memcpy(page.data, &stamp, sizeof(Stamp));
+    for (size_t i = sizeof(Stamp); i + sizeof(uint64_t) <= page.size; i += sizeof(uint64_t)) {
+        uint64_t word = patternWord(stamp, i);
+        std::memcpy(page.data + i, &word, sizeof(word));
+    }
+}
+
+bool checkPattern(PageSpan page, Stamp& stamp) {
+    std::memcpy(&stamp, page.data, sizeof(Stamp));
+    for (size_t i = sizeof(Stamp); i + sizeof(uint64_t) <= page.size; i += sizeof(uint64_t)) {
+        uint64_t word = patternWord(stamp, i);
+        if (std::memcmp(page.data + i, &word, sizeof(word)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+PoolGeometry geometryOption(const Options& options) {
+    PoolGeometry geometry;
+    geometry.pagesCount = options.getInt("pages", geometry.pagesCount);
+    geometry.pageSize = options.getSize("page-size", geometry.pageSize);
+    if (options.has("broadcast")) {
+        geometry.mode = PoolMode::Broadcast;
+    }
+    geometry.budgets = options.has("budget");
+    geometry.stealing = options.has("steal");
+    geometry.checksums = options.has("integrity") || options.has("checksums");
+    geometry.compression = options.has("compress");
+    // Checked by main
+    parseFairness(options.get("fairness", "race"), geometry.fairness);
+    return geometry.normalized();
+}
+
+MapOptions memoryOption(const Options& options) {
+    MapOptions memory;
+    memory.hugePages = options.has("huge-pages");
+    memory.prefault = options.has("prefault");
+    return memory;
+}
+
+// Spread of the per-worker mean waits shows how fair the pool was to them
+void printWaits(const char* role, std::vector<WaitStats>::const_iterator first, std::vector<WaitStats>::const_iterator last) {
+    double minMean = 0;
+    double maxMean = 0;
+    uint64_t maxNs = 0;
+    for (auto stats = first; stats != last; ++stats) {
+        double mean = stats->acquires > 0 ? (double)stats->totalNs / stats->acquires / 1000 : 0;
+        minMean = stats == first ? mean : std::min(minMean, mean);
+        maxMean = std::max(maxMean, mean);
+        maxNs = std::max(maxNs, stats->maxNs);
+    }
+    std::cout << role << " waits: mean " << std::fixed << std::setprecision(1) << minMean << " to " << maxMean
+              << " us per worker, longest " << maxNs / 1000 << " us" << std::defaultfloat << std::endl;
+}
+
+// Stress runs always start from an empty pool
+void removePoolFile(const PoolFile& file) {
+    if (!file.path.empty()) {
+        std::remove((file.path + ".ctl").c_str());
+        std::remove((file.path + ".pages").c_str());
+    }
+}
+
+// Every worker maps the pool on its own, just like separate chit/pis processes would
+int stress(const Options& options) {
+    int writers = options.getInt("writers", 4);
+    int readers = options.getInt("readers", 4);
+    int seconds = options.getInt("seconds", 5);
+    int batchSize = std::max(1, options.getInt("batch", 1));
+    // Multi-page records instead of single pages
+    int recordSize = options.getSize("record", 0) / sizeof(Stamp) * sizeof(Stamp);
+    PoolGeometry geometry = geometryOption(options);
+    // Separate channels let several benches run side by side
+    std::wstring channel = widen(options.get("channel"));
+    if (!PagePool::validChannel(channel)) {
+        std::cout << "bad channel name" << std::endl;
+        return 1;
+    }
+    // Every reader gets every page instead of one reader each
+    bool broadcast = geometry.mode == PoolMode::Broadcast;
+    if (broadcast && recordSize > 0) {
+        std::cout << "records are not supported in broadcast mode" << std::endl;
+        return 1;
+    }
+    // Only RecordWriter::write compresses, plain pages would show nothing but zeros
+    if (geometry.compression && recordSize == 0) {
+        std::cout << "--compress needs --record" << std::endl;
+        return 1;
+    }
+    // CPU sets for the two kinds of workers and the node for the pages
+    std::vector<int> writerCpus = parseCpuList(options.get("writer-cpus"));
+    std::vector<int> readerCpus = parseCpuList(options.get("reader-cpus"));
+    int node = options.getInt("node", -1);
+    // Persistent pool, the trade-off is flush interval against throughput
+    PoolFile file;
+    file.path = options.get("file");
+    file.flushIntervalMs = options.getInt("flush-ms", file.flushIntervalMs);
+    MapOptions memory = memoryOption(options);
+    PagePool::remove(channel);
+    removePoolFile(file);
+
+    // Created up front so the pages are placed before anyone touches them
+    PagePool owner(geometry, channel, file, memory);
+    if (node >= 0 && !owner.placeOnNode(node)) {
+        std::cout << "cannot place pages on node " << node << std::endl;
+    }
+
+    std::atomic<bool> running{true};
+    std::atomic<int64_t> written{0};
+    std::atomic<int64_t> read{0};
+    std::atomic<int64_t> torn{0};
+    std::atomic<int64_t> reordered{0};
+    std::atomic<int> liveReaders{readers};
+    std::atomic<int> poisonsSeen{0};
+    std::atomic<int> subscribed{0};
+    // A record that does not fit the pool stops its writer
+    std::atomic<bool> tooLarge{false};
+    // Where each worker ran and how many pages or records it went through
+    std::vector<std::pair<int, int64_t>> placement(writers + readers);
+    // Writer 0 grabs this many pages at a time, to see whether it starves the rest
+    int noisyBatch = std::max(batchSize, options.getInt("noisy", batchSize));
+    // Slow readers, so that writers outpace them. Only the first few are slow with --slow-readers.
+    int readerDelayUs = options.getInt("reader-delay", 0);
+    int slowReaders = options.getInt("slow-readers", readers);
+    // Readers steal from each other's queues, commit order only holds within one queue
+    bool ordered = !geometry.stealing;
+    // Soak test: checksummed pages full of a pattern instead of a repeated stamp, records keep theirs
+    bool integrity = options.has("integrity") && recordSize == 0;
+    auto fill = integrity ? patternPage : stampPage;
+    auto check = integrity ? checkPattern : checkPage;
+    std::vector<IntegrityStats> integrityStats(readers);
+    std::vector<CompressionStats> compressionStats(writers);
+    std::atomic<int64_t> throttled{0};
+    std::vector<WaitStats> waits(writers + readers);
+    // Workers share the owner's mappings the way threads of one process do, unless told to map on their own
+    bool ownMappings = options.has("own-mappings");
+    std::atomic<int64_t> attachNs{0};
+    auto attach = [&]() {
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<PoolMapping> mapping = ownMappings ? PagePool::open(geometry, channel, file, memory) : owner.mapping();
+        attachNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        return mapping;
+    };
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; ++w) {
+        threads.emplace_back([&, w]() {
+            if (!writerCpus.empty()) {
+                pinThread(writerCpus);
+            }
+            PagePool pool(attach());
+            // Broadcast readers only see what was written after they subscribed
+            while (subscribed < readers && broadcast) {
+                std::this_thread::yield();
+            }
+            int32_t counter = 0;
+            std::vector<Stamp> record(recordSize / sizeof(Stamp));
+            while (running && recordSize > 0) {
+                std::fill(record.begin(), record.end(), Stamp{w, counter++});
+                RecordWriter writer(pool);
+                if (!writer.write(record.data(), recordSize) || writer.commit() < 0) {
+                    tooLarge = true;
+                    break;
+                }
+                ++written;
+            }
+            while (running && recordSize == 0) {
+                PageBatch batch = pool.batch(false, w == 0 ? noisyBatch : batchSize);
+                for (int i = 0; i < batch.size(); ++i) {
+                    fill(batch.span(i), {w, counter++});
+                }
+                written += batch.size();
+            }
+            placement[w] = {currentNode(), counter};
+            waits[w] = pool.waitStats(false);
+            compressionStats[w] = pool.compression();
+            if (const WriterBucket* budget = pool.writerBudget()) {
+                throttled += budget->throttled;
+            }
+        });
+    }
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r]() {
+            if (!readerCpus.empty()) {
+                pinThread(readerCpus);
+            }
+            PagePool pool(attach());
+            if (broadcast && pool.subscribe()) {
+                ++subscribed;
+            }
+            int64_t lastSequence = -1;
+            int64_t accesses = 0;
+            while (recordSize > 0) {
+                RecordLease record(pool);
+                Stamp first{};
+                std::memcpy(&first, record.spans()[0].data, sizeof(Stamp));
+                // Every page of the record must carry the same stamp
+                for (const PageSpan& span : record.spans()) {
+                    Stamp stamp{};
+                    if (!checkPage(span, stamp) || stamp.writer != first.writer || stamp.counter != first.counter) {
+                        ++torn;
+                    }
+                }
+                auto sequence = (int64_t)record.sequence();
+                if (ordered && sequence <= lastSequence) {
+                    ++reordered;
+                }
+                lastSequence = sequence;
+                if (first.writer == POISON) {
+                    ++poisonsSeen;
+                    break;
+                }
+                if (record.size() != (size_t)recordSize) {
+                    ++torn;
+                }
+                ++read;
+                ++accesses;
+            }
+            while (recordSize == 0) {
+                PageBatch batch = pool.batch(true, batchSize);
+                bool poisoned = false;
+                for (int i = 0; i < batch.size(); ++i) {
+                    Stamp stamp{};
+                    if (!check(batch.span(i), stamp)) {
+                        ++torn;
+                    }
+                    // Pops are in commit order, so one reader must see strictly growing sequences.
+                    // A broadcast reader must see all of them, without gaps.
+                    auto sequence = (int64_t)batch.sequence(i);
+                    if ((ordered && sequence <= lastSequence) || (broadcast && sequence != lastSequence + 1)) {
+                        ++reordered;
+                    }
+                    lastSequence = sequence;
+                    if (stamp.writer == POISON) {
+                        poisoned = true;
+                        ++poisonsSeen;
+                    } else {
+                        ++read;
+                        ++accesses;
+                    }
+                }
+                batch.release();
+                if (readerDelayUs > 0 && r < slowReaders) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(readerDelayUs));
+                }
+                if (poisoned) {
+                    break;
+                }
+            }
+            placement[writers + r] = {currentNode(), accesses};
+            waits[writers + r] = pool.waitStats(true);
+            integrityStats[r] = pool.integrity();
+            --liveReaders;
+        });
+    }
+
+    auto start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    for (int w = 0; w < writers; ++w) {
+        threads[w].join();
+    }
+    {
+        // A batch may swallow several poison pills, so top them up until every reader is gone.
+        // In broadcast mode a single pill reaches everyone.
+        PagePool& pool = owner;
+        int posted = 0;
+        while (liveReaders > 0) {
+            if (posted < (broadcast ? 1 : readers) || (!broadcast && poisonsSeen == posted)) {
+                PageLease lease = pool.lease(false);
+                fill(lease.span(), {POISON, 0});
+                ++posted;
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+    for (int r = 0; r < readers; ++r) {
+        threads[writers + r].join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Cross-node traffic estimate: every access of a worker costs as much as the remote share of the pages from its node
+    std::vector<int> pageNodes = owner.pageNodes();
+    std::vector<int> perNode(numaNodes());
+    for (int pageNode : pageNodes) {
+        if (pageNode >= 0 && pageNode < (int)perNode.size()) {
+            ++perNode[pageNode];
+        }
+    }
+    double accesses = 0;
+    double remote = 0;
+    for (const auto& worker : placement) {
+        accesses += worker.second;
+        remote += worker.second * remoteShare(pageNodes, worker.first);
+    }
+    PagePool::remove(channel);
+    removePoolFile(file);
+
+    std::cout << "writers " << writers << ", readers " << readers << ", " << elapsed << " s, "
+              << geometry.pagesCount << " pages of " << geometry.pageSize << " bytes";
+    if (recordSize > 0) {
+        std::cout << ", records of " << recordSize << " bytes";
+    }
+    std::cout << std::endl;
+    std::cout << "OS pages per node:";
+    for (int count : perNode) {
+        std::cout << " " << count;
+    }
+    std::cout << ", cross-node accesses " << std::fixed << std::setprecision(1)
+              << (accesses > 0 ? remote / accesses * 100 : 0) << "%" << std::defaultfloat << ", " << backingName(owner.backing()) << std::endl;
+    if (geometry.budgets || noisyBatch != batchSize) {
+        auto minmax = std::minmax_element(placement.begin(), placement.begin() + writers);
+        std::cout << "per writer " << minmax.first->second << " to " << minmax.second->second
+                  << " (writer 0: " << placement[0].second << "), throttled " << throttled << std::endl;
+    }
+    if (readerDelayUs > 0 || geometry.stealing) {
+        auto minmax = std::minmax_element(placement.begin() + writers, placement.end());
+        std::cout << "per reader " << minmax.first->second << " to " << minmax.second->second
+                  << (geometry.stealing ? ", work stealing" : "") << std::endl;
+    }
+    std::cout << "fairness " << fairnessName(geometry.fairness) << ", " << (ownMappings ? "own" : "shared") << " mappings, "
+              << attachNs / 1000 / (writers + readers) << " us to attach a worker" << std::endl;
+    printWaits("writer", waits.begin(), waits.begin() + writers);
+    printWaits("reader", waits.begin() + writers, waits.end());
+    IntegrityStats found;
+    for (const IntegrityStats& stats : integrityStats) {
+        found.verified += stats.verified;
+        found.corrupted += stats.corrupted;
+        found.reordered += stats.reordered;
+        found.lost += stats.lost;
+    }
+    if (geometry.compression) {
+        CompressionStats total;
+        for (const CompressionStats& stats : compressionStats) {
+            total.bypassed += stats.bypassed;
+            total.compressed += stats.compressed;
+            total.rawBytes += stats.rawBytes;
+            total.storedBytes += stats.storedBytes;
+            for (int i = 0; i < 4; ++i) {
+                total.ratios[i] += stats.ratios[i];
+            }
+        }
+        std::cout << "compression: " << total.compressed << " pages compressed, " << total.bypassed << " stored as is, ratio "
+                  << std::fixed << std::setprecision(2) << (total.storedBytes > 0 ? (double)total.rawBytes / total.storedBytes : 0)
+                  << std::defaultfloat << ", per page below 2x " << total.ratios[0] << ", below 4x " << total.ratios[1]
+                  << ", below 8x " << total.ratios[2] << ", 8x and up " << total.ratios[3] << std::endl;
+    }
+    if (geometry.checksums) {
+        std::cout << "checksums (" << crcKernelName(bestCrcKernel()) << "): verified " << found.verified << ", corrupted " << found.corrupted
+                  << ", reordered " << found.reordered << ", lost " << found.lost << std::endl;
+    }
+    int64_t expected = broadcast ? written * readers : (int64_t)written;
+    std::cout << "written " << written << ", read " << read << ", lost " << std::max<int64_t>(0, expected - read)
+              << ", torn " << torn << ", reordered " << reordered << std::endl;
+    std::cout << (int64_t)(read / elapsed) << (recordSize > 0 ? " records/s" : " pages/s") << std::endl;
+    if (tooLarge) {
+        std::cout << "record too large for the pool" << std::endl;
+    }
+    bool intact = found.corrupted == 0 && found.reordered == 0 && found.lost == 0;
+    return expected == read && torn == 0 && reordered == 0 && intact && !tooLarge ? 0 : 1;
+}
+
+
+// Counting semaphore made of a shared counter and an event count, the way PagePool waits on its rings
+class EventSemaphore {
+public:
+    EventSemaphore(std::atomic<int32_t>* count, EventWord* word, const std::wstring& name)
+        : count(count)
+        , event(word, name)
+    {}
+
+    void acquire() {
+        waitFor(event, [&]() {
+            int32_t value = count->load(std::memory_order_relaxed);
+            while (value > 0) {
+                if (count->compare_exchange_weak(value, value - 1, std::memory_order_acquire)) {
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+
+    void release() {
+        count->fetch_add(1, std::memory_order_release);
+        event.notify();
+    }
+
+private:
+    std::atomic<int32_t>* count;
+    EventCount event;
+};
+
+struct alignas(64) EventSemaphoreWords {
+    std::atomic<int32_t> count;
+    alignas(64) EventWord word;
+};
+
+template<typename Sem>
+void runSemBench(const char* name, Sem& first, Sem& second, int iterations) {
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        first.release();
+        first.acquire();
+    }
+    double uncontended = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+
+    // Ping-pong: every round trip is two hand-offs that must wake the other side
+    std::thread pong([&]() {
+        for (int i = 0; i < iterations; ++i) {
+            first.acquire();
+            second.release();
+        }
+    });
+    start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        first.release();
+        second.acquire();
+    }
+    double roundTrip = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+    pong.join();
+
+    std::cout << name << ": release+acquire " << uncontended << " ns, ping-pong round trip " << roundTrip << " ns" << std::endl;
+}
+
+int semBench(int iterations) {
+    {
+        Semaphore::remove(L"BenchSemaphore1");
+        Semaphore::remove(L"BenchSemaphore2");
+        Semaphore first(L"BenchSemaphore1", 0, INT32_MAX);
+        Semaphore second(L"BenchSemaphore2", 0, INT32_MAX);
+        runSemBench("Semaphore", first, second, iterations);
+        Semaphore::remove(L"BenchSemaphore1");
+        Semaphore::remove(L"BenchSemaphore2");
+    }
+    {
+        MemMapping::remove(L"BenchEvents");
+        MemMapping mapping(L"BenchEvents", 2 * sizeof(EventSemaphoreWords));
+        auto* words = mapping.data<EventSemaphoreWords>();
+        EventSemaphore first(&words[0].count, &words[0].word, L"BenchEvent1");
+        EventSemaphore second(&words[1].count, &words[1].word, L"BenchEvent2");
+        runSemBench("EventCount", first, second, iterations);
+        MemMapping::remove(L"BenchEvents");
+    }
+    return 0;
+}
+
+// kill -9 test: a child process grabs pages (and in queue mode the record assembly lock) and
+// dies holding them, then the parent reclaims and checks the whole pool is usable again
+int reclaimBench(const Options& options) {
+#ifdef _WIN32
+    std::cout << "reclaim needs fork, POSIX only" << std::endl;
+    return 1;
+#else
+    PoolGeometry geometry = geometryOption(options);
+    bool broadcast = geometry.mode == PoolMode::Broadcast;
+    PagePool::remove();
+    PagePool pool(geometry);
+    int pagesCount = pool.geometry().pagesCount;
+    int held = std::max(1, std::min(options.getInt("held", pagesCount / 2), pagesCount - 1));
+
+    int ready[2];
+    if (pipe(ready) != 0) {
+        return 1;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        PagePool childPool(geometry);
+        std::vector<PageLease> leases;
+        std::unique_ptr<RecordWriter> record;
+        if (broadcast) {
+            childPool.subscribe();
+            leases.push_back(childPool.lease(false));
+        } else {
+            record = std::make_unique<RecordWriter>(childPool);
+            record->grow();
+            for (int i = 1; i < held; ++i) {
+                leases.push_back(childPool.lease(false));
+            }
+        }
+        char byte = 1;
+        (void)!write(ready[1], &byte, 1);
+        pause();
+        _exit(0);
+    }
+    char byte = 0;
+    (void)!read(ready[0], &byte, 1);
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+
+    // Queue: the held pages and the lock. Broadcast: the claimed slot and the reader cursor.
+    int expected = broadcast ? 2 : held + 1;
+    int reclaimed = pool.reclaim();
+    std::cout << "child " << child << " killed holding " << (broadcast ? 1 : held) << " of " << pagesCount
+              << " pages, reclaimed " << reclaimed << " of " << expected << std::endl;
+    if (reclaimed != expected) {
+        PagePool::remove();
+        return 1;
+    }
+    // Would block forever on anything still lost: every page goes through a write and a read
+    if (broadcast) {
+        pool.subscribe();
+    }
+    for (bool isChit : {false, true}) {
+        std::vector<PageBatch> batches;
+        for (int taken = 0; taken < pagesCount; taken += batches.back().size()) {
+            batches.push_back(pool.batch(isChit, pagesCount - taken));
+        }
+    }
+    if (!broadcast) {
+        RecordWriter writer(pool);
+        writer.grow();
+    }
+    std::cout << "pool fully usable again" << std::endl;
+    PagePool::remove();
+    return 0;
+#endif
+}
+
+// One writer keeps replacing the latest value, readers that only want the newest one copy it out
+// as fast as they can. Every snapshot is its number repeated, so a torn copy shows.
+int snapshotBench(const Options& options) {
+    int readers = options.getInt("readers", 4);
+    int seconds = options.getInt("seconds", 5);
+    PoolGeometry geometry;
+    geometry.pagesCount = 1;
+    geometry.snapshotSize = std::max((int)sizeof(uint64_t), options.getSize("size", 256)) / sizeof(uint64_t) * sizeof(uint64_t);
+    const std::wstring channel = L"SnapshotBench";
+    PagePool::remove(channel);
+    PagePool owner(geometry, channel);
+    size_t words = owner.geometry().snapshotSize / sizeof(uint64_t);
+
+    std::atomic<bool> running{true};
+    std::atomic<int64_t> torn{0};
+    std::atomic<int64_t> reordered{0};
+    std::vector<SnapshotStats> stats(readers + 1);
+    std::vector<std::thread> threads;
+    threads.emplace_back([&]() {
+        PagePool pool(owner.mapping());
+        std::vector<uint64_t> value(words);
+        for (uint64_t number = 1; running; ++number) {
+            std::fill(value.begin(), value.end(), number);
+            pool.publish(value.data(), value.size() * sizeof(uint64_t));
+        }
+        stats[0] = pool.snapshots();
+    });
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r]() {
+            PagePool pool(owner.mapping());
+            std::vector<uint64_t> value(words);
+            uint64_t last = 0;
+            while (running) {
+                size_t size = 0;
+                uint64_t number = pool.latest(value.data(), value.size() * sizeof(uint64_t), size);
+                if (number == 0) {
+                    continue;
+                }
+                if (size != value.size() * sizeof(uint64_t) || std::count(value.begin(), value.end(), number) != (int64_t)words) {
+                    ++torn;
+                }
+                if (number < last) {
+                    ++reordered;
+                }
+                last = number;
+            }
+            stats[r + 1] = pool.snapshots();
+        });
+    }
+    auto start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    PagePool::remove(channel);
+
+    SnapshotStats read;
+    for (int r = 1; r <= readers; ++r) {
+        read.reads += stats[r].reads;
+        read.retries += stats[r].retries;
+    }
+    std::cout << "1 writer, " << readers << " readers, " << elapsed << " s, snapshots of " << words * sizeof(uint64_t) << " bytes" << std::endl;
+    std::cout << (int64_t)(stats[0].published / elapsed) << " published/s, " << (int64_t)(read.reads / elapsed) << " read/s, "
+              << std::fixed << std::setprecision(3) << (read.reads > 0 ? (double)read.retries / read.reads : 0)
+              << std::defaultfloat << " retries per read" << std::endl;
+    std::cout << "torn " << torn << ", reordered " << reordered << std::endl;
+    return torn == 0 && reordered == 0 ? 0 : 1;
+}
+
+#ifdef __linux__
+// Data TLB misses of this thread in user space, perf may well be off limits in a container
+class TlbCounter {
+public:
+    TlbCounter() {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~TlbCounter() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    void start() {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    // Minus one when there is no counter
+    int64_t stop() {
+        uint64_t count = 0;
+        if (fd < 0 || ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) != 0 || read(fd, &count, sizeof(count)) != sizeof(count)) {
+            return -1;
+        }
+        return (int64_t)count;
+    }
+
+private:
+    int fd;
+};
+#else
+class TlbCounter {
+public:
+    void start() {}
+    int64_t stop() { return -1; }
+};
+#endif
+
+struct StartupCost {
+    PageBacking backing;
+    double createMs;
+    double attachMs;
+    double touchMs;
+    double worstTouchUs;
+    double accessNs;
+    int64_t tlbMisses;
+};
+
+// Creates a pool, then maps it once more the way a restarted process would, with empty page tables.
+// That mapping writes every page once and reads single bytes all over them, which is where TLB reach shows.
+StartupCost startupCost(const PoolGeometry& geometry, const MapOptions& memory, int accesses) {
+    const std::wstring channel = L"StartupBench";
+    PagePool::remove(channel);
+    StartupCost cost{};
+    auto start = Clock::now();
+    PagePool owner(geometry, channel, {}, memory);
+    cost.createMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    start = Clock::now();
+    PagePool pool(PagePool::open(geometry, channel, {}, memory));
+    cost.attachMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    cost.backing = pool.backing();
+
+    std::vector<PageBatch> batches;
+    std::vector<PageSpan> pages;
+    int pagesCount = pool.geometry().pagesCount;
+    start = Clock::now();
+    for (int taken = 0; taken < pagesCount; taken += batches.back().size()) {
+        batches.push_back(pool.batch(false, pagesCount - taken));
+        PageBatch& batch = batches.back();
+        for (int i = 0; i < batch.size(); ++i) {
+            auto pageStart = Clock::now();
+            std::memset(batch.span(i).data, 1, batch.span(i).size);
+            cost.worstTouchUs = std::max(cost.worstTouchUs, std::chrono::duration<double, std::micro>(Clock::now() - pageStart).count());
+            pages.push_back(batch.span(i));
+        }
+    }
+    cost.touchMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    uint64_t state = 88172645463325252ull;
+    uint64_t sum = 0;
+    TlbCounter tlb;
+    start = Clock::now();
+    tlb.start();
+    for (int i = 0; i < accesses; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        const PageSpan& page = pages[state % pages.size()];
+        sum += page.data[(state >> 32) % page.size];
+    }
+    cost.tlbMisses = tlb.stop();
+    cost.accessNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / accesses;
+    volatile uint64_t sink = sum;
+    (void)sink;
+
+    batches.clear();
+    PagePool::remove(channel);
+    return cost;
+}
+
+// What huge pages and prefaulting buy: slower creation against no faults and fewer TLB misses later on
+int startupBench(const Options& options) {
+    PoolGeometry geometry;
+    geometry.pagesCount = options.getInt("pages", 16384);
+    geometry.pageSize = options.getSize("page-size", geometry.pageSize);
+    geometry = geometry.normalized();
+    int accesses = options.getInt("accesses", 10000000);
+    std::cout << geometry.pagesCount << " pages of " << geometry.pageSize << " bytes, "
+              << SharedObject::pagesBytes(geometry) / 1024 / 1024 << " MiB, " << accesses << " random reads" << std::endl;
+    std::cout << std::setw(14) << "variant" << std::setw(24) << "backing" << std::setw(12) << "create ms" << std::setw(12) << "attach ms" << std::setw(12) << "touch ms"
+              << std::setw(16) << "worst page us" << std::setw(12) << "read ns" << std::setw(14) << "dTLB misses" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    struct Variant {
+        const char* name;
+        MapOptions memory;
+    };
+    for (const Variant& variant : {Variant{"plain", {false, false}}, Variant{"prefault", {false, true}},
+                                   Variant{"huge", {true, false}}, Variant{"huge+prefault", {true, true}}}) {
+        StartupCost cost = startupCost(geometry, variant.memory, accesses);
+        std::cout << std::setw(14) << variant.name << std::setw(24) << backingName(cost.backing)
+                  << std::setw(12) << cost.createMs << std::setw(12) << cost.attachMs << std::setw(12) << cost.touchMs << std::setw(16) << cost.worstTouchUs
+                  << std::setw(12) << cost.accessNs << std::setw(14);
+        if (cost.tlbMisses >= 0) {
+            std::cout << cost.tlbMisses;
+        } else {
+            std::cout << "n/a";
+        }
+        std::cout << std::endl;
+    }
+    std::cout << std::defaultfloat;
+    return 0;
+}
+
+struct TaskCounters {
+    std::atomic<bool> running{true};
+    std::atomic<int> writers{0};
+    std::atomic<int64_t> written{0};
+    std::atomic<int64_t> read{0};
+    std::atomic<int64_t> torn{0};
+    std::atomic<int64_t> reordered{0};
+};
+
+Task writeTask(PagePool& pool, int writer, int batchSize, TaskCounters& counters) {
+    int32_t counter = 0;
+    while (counters.running) {
+        PageBatch batch = co_await pool.acquireWrite(batchSize);
+        for (int i = 0; i < batch.size(); ++i) {
+            stampPage(batch.span(i), {writer, counter++});
+        }
+        counters.written += batch.size();
+    }
+    --counters.writers;
+}
+
+// Runs until its loop stops
+Task readTask(PagePool& pool, int batchSize, bool ordered, TaskCounters& counters) {
+    int64_t lastSequence = -1;
+    while (true) {
+        PageBatch batch = co_await pool.acquireRead(batchSize);
+        for (int i = 0; i < batch.size(); ++i) {
+            Stamp stamp{};
+            if (!checkPage(batch.span(i), stamp)) {
+                ++counters.torn;
+            }
+            auto sequence = (int64_t)batch.sequence(i);
+            if (ordered && sequence <= lastSequence) {
+                ++counters.reordered;
+            }
+            lastSequence = sequence;
+        }
+        counters.read += batch.size();
+    }
+}
+
+// Stops the writers after the given time and the loop once the readers have caught up
+Task stopTask(EventLoop& loop, int seconds, int64_t readers, TaskCounters& counters) {
+    co_await loop.sleep(std::chrono::seconds(seconds));
+    counters.running = false;
+    // A writer that was waiting for pages still commits them
+    while (counters.writers > 0 || counters.read < counters.written * readers) {
+        co_await loop.sleep(std::chrono::milliseconds(1));
+    }
+    loop.stop();
+}
+
+// Writers and readers as tasks of one event loop on one thread, or with --split writers and readers
+// on a loop each, which then park on the pool's events whenever the other side is behind
+int taskBench(const Options& options) {
+    int writers = options.getInt("writers", 4);
+    int readers = options.getInt("readers", 4);
+    int seconds = options.getInt("seconds", 5);
+    int batchSize = std::max(1, options.getInt("batch", 1));
+    bool split = options.has("split");
+    PoolGeometry geometry = geometryOption(options);
+    bool broadcast = geometry.mode == PoolMode::Broadcast;
+    const std::wstring channel = L"TaskBench";
+    PagePool::remove(channel);
+    PagePool owner(geometry, channel);
+
+    TaskCounters counters;
+    counters.writers = writers;
+    std::vector<std::unique_ptr<PagePool>> pools;
+    EventLoop writerLoop;
+    EventLoop readerLoop;
+    EventLoop& readerSide = split ? readerLoop : writerLoop;
+    // Broadcast readers only get what is published after they subscribe. On their first acquire
+    // would be too late with --split, the writer loop may be running by then.
+    for (int r = 0; r < readers; ++r) {
+        pools.push_back(std::make_unique<PagePool>(owner.mapping()));
+        if (broadcast) {
+            pools.back()->subscribe();
+        }
+        readerSide.spawn(readTask(*pools.back(), batchSize, !geometry.stealing, counters));
+    }
+    for (int w = 0; w < writers; ++w) {
+        pools.push_back(std::make_unique<PagePool>(owner.mapping()));
+        writerLoop.spawn(writeTask(*pools.back(), w, batchSize, counters));
+    }
+    readerSide.spawn(stopTask(readerSide, seconds, broadcast ? readers : 1, counters));
+
+    auto start = Clock::now();
+    std::thread readerThread;
+    if (split) {
+        readerThread = std::thread([&]() {
+            readerLoop.run();
+        });
+    }
+    writerLoop.run();
+    if (split) {
+        readerThread.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Readers were spawned first
+    std::vector<WaitStats> waits;
+    for (int i = 0; i < (int)pools.size(); ++i) {
+        waits.push_back(pools[i]->waitStats(i < readers));
+    }
+    pools.clear();
+    PagePool::remove(channel);
+
+    int64_t expected = broadcast ? counters.written * readers : (int64_t)counters.written;
+    std::cout << "writer tasks " << writers << ", reader tasks " << readers << " on " << (split ? "two threads" : "one thread")
+              << ", " << elapsed << " s, " << geometry.pagesCount << " pages of " << geometry.pageSize << " bytes" << std::endl;
+    printWaits("writer", waits.cbegin() + readers, waits.cend());
+    printWaits("reader", waits.cbegin(), waits.cbegin() + readers);
+    std::cout << "written " << counters.written << ", read " << counters.read << ", lost " << std::max<int64_t>(0, expected - counters.read)
+              << ", torn " << counters.torn << ", reordered " << counters.reordered << std::endl;
+    std::cout << (int64_t)(counters.read / elapsed) << " pages/s" << std::endl;
+    return expected == counters.read && counters.torn == 0 && counters.reordered == 0 ? 0 : 1;
+}
+
+#ifndef _WIN32
+// Blocking writer threads and one reader that only ever waits in poll(2) on the pool's readiness
+// descriptor, the way a reader with sockets of its own would. Counts wake-ups against pages to show
+// how much the empty-to-non-empty signaling coalesces.
+int pollBench(const Options& options) {
+    int writers = options.getInt("writers", 2);
+    int seconds = options.getInt("seconds", 5);
+    int batchSize = std::max(1, options.getInt("batch", 1));
+    int writerDelay = options.getInt("writer-delay", 0);
+    PoolGeometry geometry = geometryOption(options);
+    const std::wstring channel = L"PollBench";
+    PagePool::remove(channel);
+    PagePool owner(geometry, channel);
+
+    // Registers, and subscribes in broadcast pools, before the first page is written
+    PagePool reader(owner.mapping());
+    pollfd descriptor{reader.pollHandle(true), POLLIN, 0};
+
+    TaskCounters counters;
+    counters.writers = writers;
+    std::vector<std::thread> threads;
+    std::vector<WaitStats> waits(writers);
+    for (int w = 0; w < writers; ++w) {
+        threads.emplace_back([&, w]() {
+            PagePool pool(owner.mapping());
+            int32_t counter = 0;
+            while (counters.running) {
+                PageBatch batch = pool.batch(false, batchSize);
+                for (int i = 0; i < batch.size(); ++i) {
+                    stampPage(batch.span(i), {w, counter++});
+                }
+                counters.written += batch.size();
+                batch.release();
+                if (writerDelay > 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(writerDelay));
+                }
+            }
+            --counters.writers;
+            waits[w] = pool.waitStats(false);
+        });
+    }
+
+    int64_t wakeups = 0;
+    int64_t empty = 0;
+    int64_t lastSequence = -1;
+    auto start = Clock::now();
+    auto stop = start + std::chrono::seconds(seconds);
+    while (counters.writers > 0 || counters.read < counters.written) {
+        if (counters.running && Clock::now() >= stop) {
+            counters.running = false;
+        }
+        // The timeout only matters for noticing the stop, and the writers that never come back
+        if (poll(&descriptor, 1, 100) <= 0) {
+            continue;
+        }
+        ++wakeups;
+        reader.pollReset(true);
+        int64_t taken = 0;
+        while (true) {
+            PageBatch batch = reader.tryBatch(true, batchSize);
+            if (batch.size() == 0) {
+                break;
+            }
+            for (int i = 0; i < batch.size(); ++i) {
+                Stamp stamp{};
+                if (!checkPage(batch.span(i), stamp)) {
+                    ++counters.torn;
+                }
+                auto sequence = (int64_t)batch.sequence(i);
+                if (!geometry.stealing && sequence <= lastSequence) {
+                    ++counters.reordered;
+                }
+                lastSequence = sequence;
+            }
+            taken += batch.size();
+        }
+        counters.read += taken;
+        if (taken == 0) {
+            ++empty;
+        }
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    PagePool::remove(channel);
+
+    std::cout << "writers " << writers << ", 1 polling reader, " << elapsed << " s, " << geometry.pagesCount << " pages of " << geometry.pageSize << " bytes" << std::endl;
+    printWaits("writer", waits.cbegin(), waits.cend());
+    std::cout << "wake-ups " << wakeups << ", empty " << empty << ", " << std::fixed << std::setprecision(2)
+              << (wakeups > 0 ? (double)counters.read / wakeups : 0) << std::defaultfloat << " pages per wake-up" << std::endl;
+    std::cout << "written " << counters.written << ", read " << counters.read << ", lost " << std::max<int64_t>(0, counters.written - counters.read)
+              << ", torn " << counters.torn << ", reordered " << counters.reordered << std::endl;
+    std::cout << (int64_t)(counters.read / elapsed) << " pages/s" << std::endl;
+    return counters.written == counters.read && counters.torn == 0 && counters.reordered == 0 ? 0 : 1;
+}
+#endif
+
+// Nanosecond latencies in 16 buckets per power of two, so percentiles are within 6 %
+class LatencyHistogram {
+public:
+    void add(uint64_t ns) {
+        ++counts[bucket(ns)];
+        ++total;
+        longest = std::max(longest, ns);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        longest = std::max(longest, other.longest);
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    // Upper edge of the bucket holding the given fraction of the samples
+    uint64_t percentile(double fraction) const {
+        auto rank = (uint64_t)(fraction * total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen > rank) {
+                return std::min(longest, upperEdge(i));
+            }
+        }
+        return longest;
+    }
+
+    void print(const char* label) const {
+        std::cout << label << ": " << std::fixed << std::setprecision(1);
+        const std::pair<const char*, double> shown[] = {{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p99.9", 0.999}};
+        for (const auto& [name, fraction] : shown) {
+            std::cout << name << " " << percentile(fraction) / 1000.0 << " us, ";
+        }
+        std::cout << "max " << longest / 1000.0 << " us" << std::defaultfloat << std::endl;
+    }
+
+private:
+    static const int SUB_BUCKETS = 16;
+
+    static size_t bucket(uint64_t ns) {
+        if (ns < SUB_BUCKETS) {
+            return ns;
+        }
+        int top = std::bit_width(ns) - 1;
+        return (top - 3) * SUB_BUCKETS + ((ns >> (top - 4)) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t upperEdge(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        int top = index / SUB_BUCKETS + 3;
+        return ((SUB_BUCKETS + index % SUB_BUCKETS + 1) << (top - 4)) - 1;
+    }
+
+    std::vector<uint64_t> counts = std::vector<uint64_t>(61 * SUB_BUCKETS);
+    uint64_t total = 0;
+    uint64_t longest = 0;
+};
+
+// Head of every pipeline page, the rest of the page is payload
+struct Message {
+    int32_t writer;
+    int32_t counter;
+    uint64_t sentNs;
+};
+
+uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+#ifndef _WIN32
+// Round trips of one page between two processes: this one writes a ping, a forked child copies it
+// into a pong on a second channel. Both sides block on the pools' events as usual.
+LatencyHistogram pingPong(PoolGeometry geometry, int seconds) {
+    // One reader per channel, broadcasting would only add a subscription race
+    geometry.mode = PoolMode::Queue;
+    LatencyHistogram roundTrips;
+    const std::wstring pingChannel = L"PingBench";
+    const std::wstring pongChannel = L"PongBench";
+    PagePool::remove(pingChannel);
+    PagePool::remove(pongChannel);
+    PagePool ping(geometry, pingChannel);
+    PagePool pong(geometry, pongChannel);
+
+    pid_t parent = getpid();
+    pid_t child = fork();
+    if (child == 0) {
+#ifdef __linux__
+        // The child blocks on the ping channel, nobody would ever wake it up once the parent is gone
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+        if (getppid() != parent) {
+            _exit(1);
+        }
+        PagePool childPing(geometry, pingChannel);
+        PagePool childPong(geometry, pongChannel);
+        while (true) {
+            PageLease in = childPing.lease(true);
+            PageLease out = childPong.lease(false);
+            copyPage(out.span().data, in.span().data, in.span().size);
+            Message message{};
+            std::memcpy(&message, in.span().data, sizeof(message));
+            if (message.writer == POISON) {
+                break;
+            }
+        }
+        _exit(0);
+    }
+    auto stop = Clock::now() + std::chrono::seconds(seconds);
+    for (int32_t counter = 0; ; ++counter) {
+        bool last = Clock::now() >= stop;
+        Message message{last ? POISON : 0, counter, nowNs()};
+        {
+            PageLease out = ping.lease(false);
+            std::memcpy(out.span().data, &message, sizeof(message));
+        }
+        PageLease in = pong.lease(true);
+        Message echo{};
+        std::memcpy(&echo, in.span().data, sizeof(echo));
+        if (last) {
+            break;
+        }
+        roundTrips.add(nowNs() - echo.sentNs);
+    }
+    waitpid(child, nullptr, 0);
+    PagePool::remove(pingChannel);
+    PagePool::remove(pongChannel);
+    return roundTrips;
+}
+#endif
+
+// The transport flat out: writers fill whole pages and readers copy them out, nothing else.
+// Latency is from a writer's commit to a reader's take, queueing in a full pool included.
+int pipelineBench(const Options& options) {
+    int writers = options.getInt("writers", 2);
+    int readers = options.getInt("readers", 2);
+    int seconds = options.getInt("seconds", 5);
+    int batchSize = std::max(1, options.getInt("batch", 1));
+    int pingSeconds = options.getInt("ping-seconds", 2);
+    PoolGeometry geometry = geometryOption(options);
+    bool broadcast = geometry.mode == PoolMode::Broadcast;
+    const std::wstring channel = L"PipelineBench";
+    PagePool::remove(channel);
+    PagePool owner(geometry, channel, {}, memoryOption(options));
+    size_t pageSize = geometry.pageSize;
+
+    std::atomic<bool> running{true};
+    std::atomic<int64_t> written{0};
+    std::atomic<int64_t> read{0};
+    std::atomic<int> liveReaders{readers};
+    std::atomic<int> poisonsSeen{0};
+    std::atomic<int> subscribed{0};
+    std::vector<LatencyHistogram> latencies(readers);
+    std::vector<WaitStats> waits(writers + readers);
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; ++w) {
+        threads.emplace_back([&, w]() {
+            PagePool pool(owner.mapping());
+            while (subscribed < readers && broadcast) {
+                std::this_thread::yield();
+            }
+            std::vector<char> payload(pageSize, (char)w);
+            int32_t counter = 0;
+            while (running) {
+                PageBatch batch = pool.batch(false, batchSize);
+                for (int i = 0; i < batch.size(); ++i) {
+                    copyPage(batch.span(i).data, payload.data(), pageSize);
+                }
+                // Stamped last, the latency is the transport's and not the copy's
+                uint64_t sentNs = nowNs();
+                for (int i = 0; i < batch.size(); ++i) {
+                    Message message{w, counter++, sentNs};
+                    std::memcpy(batch.span(i).data, &message, sizeof(message));
+                }
+                written += batch.size();
+            }
+            waits[w] = pool.waitStats(false);
+        });
+    }
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r]() {
+            PagePool pool(owner.mapping());
+            if (broadcast && pool.subscribe()) {
+                ++subscribed;
+            }
+            std::vector<char> copy(pageSize);
+            bool poisoned = false;
+            while (!poisoned) {
+                PageBatch batch = pool.batch(true, batchSize);
+                uint64_t takenNs = nowNs();
+                for (int i = 0; i < batch.size(); ++i) {
+                    Message message{};
+                    std::memcpy(&message, batch.span(i).data, sizeof(message));
+                    if (message.writer == POISON) {
+                        poisoned = true;
+                        ++poisonsSeen;
+                        continue;
+                    }
+                    latencies[r].add(takenNs - std::min(takenNs, message.sentNs));
+                    copyPage(copy.data(), batch.span(i).data, pageSize);
+                    ++read;
+                }
+            }
+            waits[writers + r] = pool.waitStats(true);
+            --liveReaders;
+        });
+    }
+
+    auto start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    for (int w = 0; w < writers; ++w) {
+        threads[w].join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    {
+        // As in stress: top the pills up until every reader is gone, one reaches every broadcast reader
+        int posted = 0;
+        while (liveReaders > 0) {
+            if (posted < (broadcast ? 1 : readers) || (!broadcast && poisonsSeen == posted)) {
+                PageLease lease = owner.lease(false);
+                Message message{POISON, 0, 0};
+                std::memcpy(lease.span().data, &message, sizeof(message));
+                ++posted;
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+    for (int r = 0; r < readers; ++r) {
+        threads[writers + r].join();
+    }
+    PagePool::remove(channel);
+
+    LatencyHistogram latency;
+    for (const LatencyHistogram& histogram : latencies) {
+        latency.merge(histogram);
+    }
+    int64_t expected = broadcast ? written * readers : (int64_t)written;
+    std::cout << "writers " << writers << ", readers " << readers << ", " << elapsed << " s, "
+              << geometry.pagesCount << " pages of " << pageSize << " bytes, batches of " << batchSize << std::endl;
+    std::cout << (int64_t)(read / elapsed) << " messages/s, " << std::fixed << std::setprecision(1)
+              << read * pageSize / elapsed / (1024 * 1024) << std::defaultfloat << " MiB/s" << std::endl;
+    printWaits("writer", waits.cbegin(), waits.cbegin() + writers);
+    printWaits("reader", waits.cbegin() + writers, waits.cend());
+    latency.print("commit to read");
+    std::cout << "written " << written << ", read " << read << ", lost " << std::max<int64_t>(0, expected - read) << std::endl;
+#ifndef _WIN32
+    if (pingSeconds > 0) {
+        LatencyHistogram roundTrips = pingPong(geometry, pingSeconds);
+        std::cout << "ping-pong between two processes: " << (int64_t)(roundTrips.count() / (double)pingSeconds) << " round trips/s" << std::endl;
+        roundTrips.print("round trip");
+    }
+#endif
+    return expected == read ? 0 : 1;
+}
+
+// Reclaims for everybody on a channel, for setups where workers may hang rather than die
+int janitor(const Options& options) {
+    PagePool pool(geometryOption(options), widen(options.get("channel")));
+    int interval = std::max(1, options.getInt("interval", 1000));
+    int staleMs = options.getInt("stale", 0);
+    while (true) {
+        int reclaimed = pool.reclaim(staleMs);
+        if (reclaimed > 0) {
+            std::cout << "reclaimed " << reclaimed << std::endl;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+    }
+}
+
+// Workers taking and returning pages through the pool itself, with the page headers either packed
+// into one table or each on its own line in front of the payload. The pool has spare pages so
+// nobody waits for a page, any slowdown with more threads comes from the shared control block.
+double claimThroughput(int threads, int iterations, bool packedHeaders) {
+    PoolGeometry geometry;
+    geometry.pagesCount = 4 * threads;
+    geometry.packedHeaders = packedHeaders;
+    const std::wstring channel = L"ContentionBench";
+    PagePool::remove(channel);
+    PagePool owner(geometry, channel);
+
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            PagePool pool(owner.mapping());
+            for (int i = 0; i < iterations; ++i) {
+                pool.lease(false).release();
+                pool.lease(true).release();
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    PagePool::remove(channel);
+    return 2 * threads * (double)iterations / elapsed / 1e6;
+}
+
+int contentionBench(int maxThreads, int iterations) {
+    maxThreads = std::max(1, std::min(maxThreads, MAX_READERS));
+    std::cout << "Mclaims/s" << std::setw(10) << "packed" << std::setw(10) << "headers" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        double packedRate = claimThroughput(threads, iterations, true);
+        double headerRate = claimThroughput(threads, iterations, false);
+        std::cout << std::setw(9) << threads << std::setw(10) << packedRate << std::setw(10) << headerRate << std::endl;
+    }
+    return 0;
+}
+
+double copyThroughput(CopyFunc copy, char* dst, const char* src, size_t size) {
+    // Warm up, then copy for a fixed wall time
+    copy(dst, src, size);
+    int64_t copies = 0;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::milliseconds(200);
+    while (Clock::now() < deadline) {
+        for (int i = 0; i < 16; ++i) {
+            copy(dst, src, size);
+        }
+        copies += 16;
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    return copies * (double)size / elapsed / 1e9;
+}
+
+char* alignedTo64(std::vector<char>& buf) {
+    return buf.data() + (64 - (uintptr_t)buf.data() % 64) % 64;
+}
+
+int copyBench() {
+    const size_t maxSize = 2*1024*1024;
+    std::vector<char> srcBuf(maxSize + 64, 'x');
+    std::vector<char> dstBuf(maxSize + 64, 0);
+    char* src = alignedTo64(srcBuf);
+    char* dst = alignedTo64(dstBuf);
+
+    std::cout << "copyPage uses " << copyKernelName(bestCopyKernel())
+              << ", streaming from " << STREAMING_THRESHOLD / 1024 << " KiB" << std::endl;
+    std::cout << "GB/s" << std::setw(18) << "memcpy";
+    std::vector<CopyKernel> kernels;
+    for (CopyKernel kernel : {CopyKernel::Sse2, CopyKernel::Avx2, CopyKernel::Avx512}) {
+        if (copyKernelSupported(kernel)) {
+            kernels.push_back(kernel);
+            std::cout << std::setw(9) << copyKernelName(kernel) << std::setw(9) << "+nt";
+        }
+    }
+    std::cout << std::endl;
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (size_t size = 4*1024; size <= maxSize; size *= 2) {
+        std::cout << std::setw(8) << size / 1024 << " KiB" << std::setw(10)
+                  << copyThroughput(copyFunction(CopyKernel::Scalar, false), dst, src, size);
+        for (CopyKernel kernel : kernels) {
+            std::cout << std::setw(9) << copyThroughput(copyFunction(kernel, false), dst, src, size)
+                      << std::setw(9) << copyThroughput(copyFunction(kernel, true), dst, src, size);
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+// Log lines with varying numbers, the kind of payload compression is meant for
+std::vector<char> logText(size_t size) {
+    const char* levels[] = {"INFO ", "DEBUG", "WARN ", "INFO "};
+    std::vector<char> text;
+    uint32_t state = 12345;
+    auto next = [&]() {
+        state = state * 1103515245 + 12345;
+        return state >> 8;
+    };
+    while (text.size() < size) {
+        char line[160];
+        int length = std::snprintf(line, sizeof(line), "2026-10-17T12:%02u:%02u.%03uZ %s [worker-%u] page %u committed seq=%u latency_us=%u\n",
+                                   next() % 60, next() % 60, next() % 1000, levels[next() % 4], next() % 8, next() % 4096,
+                                   next() % 1000000, next() % 500);
+        text.insert(text.end(), line, line + length);
+    }
+    text.resize(size);
+    return text;
+}
+
+// Packs the data into pages the way RecordWriter does and unpacks it again
+int lzBench() {
+    const size_t pageSize = 4096;
+    const size_t size = 4*1024*1024;
+    std::vector<char> random(size);
+    uint64_t state = 88172645463325252ull;
+    for (char& c : random) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        c = (char)state;
+    }
+    bool roundTrip = true;
+    std::cout << std::fixed << std::setprecision(2);
+    for (auto& input : {std::make_pair("log text", logText(size)), std::make_pair("random", random)}) {
+        const std::vector<char>& data = input.second;
+        std::vector<std::vector<char>> pages;
+        std::vector<size_t> rawLengths;
+        auto start = Clock::now();
+        for (size_t offset = 0; offset < data.size();) {
+            std::vector<char> page(pageSize);
+            size_t consumed = 0;
+            size_t stored = lzCompress(data.data() + offset, std::min(data.size() - offset, pageSize * 16), page.data(), pageSize, consumed);
+            page.resize(stored);
+            pages.push_back(std::move(page));
+            rawLengths.push_back(consumed);
+            offset += consumed;
+        }
+        double packSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::vector<char> unpacked(data.size());
+        size_t offset = 0;
+        size_t stored = 0;
+        start = Clock::now();
+        for (size_t i = 0; i < pages.size(); ++i) {
+            roundTrip = roundTrip && lzDecompress(pages[i].data(), pages[i].size(), unpacked.data() + offset, rawLengths[i]);
+            offset += rawLengths[i];
+            stored += pages[i].size();
+        }
+        double unpackSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+        roundTrip = roundTrip && unpacked == data;
+        std::cout << std::setw(9) << input.first << ": ratio " << (double)data.size() / stored << ", " << pages.size() << " pages for "
+                  << data.size() / pageSize << ", compress " << data.size() / packSeconds / 1e6 << " MB/s, decompress "
+                  << data.size() / unpackSeconds / 1e6 << " MB/s" << std::endl;
+    }
+    std::cout << std::defaultfloat << (roundTrip ? "round trip ok" : "round trip FAILED") << std::endl;
+    return roundTrip ? 0 : 1;
+}
+
+double crcThroughput(CrcFunc crc, const char* data, size_t size) {
+    volatile uint32_t sink = crc(0, data, size);
+    int64_t runs = 0;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::milliseconds(200);
+    while (Clock::now() < deadline) {
+        for (int i = 0; i < 16; ++i) {
+            sink = crc(sink, data, size);
+        }
+        runs += 16;
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    return runs * (double)size / elapsed / 1e9;
+}
+
+int crcBench() {
+    // The standard check value of CRC32C
+    const char check[] = "123456789";
+    std::cout << "crc32c uses " << crcKernelName(bestCrcKernel()) << ", check value " << std::hex << crc32c(check, 9)
+              << (crc32c(check, 9) == 0xe3069283 ? " ok" : " WRONG") << std::dec << std::endl;
+    std::vector<CrcKernel> kernels;
+    std::cout << "GB/s";
+    for (CrcKernel kernel : {CrcKernel::Table, CrcKernel::Sse42}) {
+        if (crcKernelSupported(kernel)) {
+            kernels.push_back(kernel);
+            std::cout << std::setw(12) << crcKernelName(kernel);
+        }
+    }
+    std::cout << std::endl;
+    bool agree = true;
+    std::vector<char> buf(64*1024);
+    for (size_t i = 0; i < buf.size(); ++i) {
+        buf[i] = (char)(i * 131 + 7);
+    }
+    std::cout << std::fixed << std::setprecision(2);
+    for (size_t size = 64; size <= buf.size(); size *= 4) {
+        std::cout << std::setw(6) << size << " B";
+        for (CrcKernel kernel : kernels) {
+            CrcFunc crc = crcFunction(kernel);
+            agree = agree && crc(0, buf.data(), size) == crcFunction(CrcKernel::Table)(0, buf.data(), size);
+            double rate = crcThroughput(crc, buf.data(), size);
+            std::cout << std::setw(12) << rate;
+        }
+        std::cout << std::endl;
+    }
+    std::cout << std::defaultfloat << (agree ? "kernels agree" : "kernels DISAGREE") << std::endl;
+    return agree ? 0 : 1;
+}
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cout << "USAGE: chit-pis-bench stress [--writers N] [--readers N] [--seconds N] [--pages N] [--page-size S] [--batch N] [--record S] [--broadcast] [--channel NAME]\n"
+                  << "                      [--writer-cpus LIST] [--reader-cpus LIST] [--node N] [--file PATH] [--flush-ms N]\n"
+                  << "                      [--budget] [--noisy N] [--reader-delay US] [--fairness race|fifo|readers|writers]\n"
+                  << "                      [--own-mappings] [--steal] [--slow-readers N] [--checksums] [--integrity] [--compress]\n"
+                  << "                      [--huge-pages] [--prefault]" << std::endl;
+        std::cout << "       chit-pis-bench pipeline [--writers N] [--readers N] [--seconds N] [--batch N] [--pages N] [--page-size S] [--broadcast]\n"
+                  << "                      [--fairness F] [--huge-pages] [--prefault] [--ping-seconds N]" << std::endl;
+        std::cout << "       chit-pis-bench startup [--pages N] [--page-size S] [--accesses N]" << std::endl;
+        std::cout << "       chit-pis-bench snapshot [--readers N] [--seconds N] [--size S]" << std::endl;
+        std::cout << "       chit-pis-bench tasks [--writers N] [--readers N] [--seconds N] [--batch N] [--split] [--pages N] [--broadcast] [--fairness F] [--budget]" << std::endl;
+        std::cout << "       chit-pis-bench poll [--writers N] [--seconds N] [--batch N] [--writer-delay US] [--pages N]" << std::endl;
+        std::cout << "       chit-pis-bench sem [--iterations N]" << std::endl;
+        std::cout << "       chit-pis-bench copy" << std::endl;
+        std::cout << "       chit-pis-bench crc" << std::endl;
+        std::cout << "       chit-pis-bench lz" << std::endl;
+        std::cout << "       chit-pis-bench contention [--threads N] [--iterations N]" << std::endl;
+        std::cout << "       chit-pis-bench reclaim [--pages N] [--held N] [--broadcast]" << std::endl;
+        std::cout << "       chit-pis-bench janitor [--channel NAME] [--interval MS] [--stale MS]" << std::endl;
+        return 1;
+    }
+    std::string mode = argv[1];
+    Options options(argc, argv, 2);
+    Fairness fairness;
+    if (!parseFairness(options.get("fairness", "race"), fairness)) {
+        std::cout << "Fairness is race, fifo, readers or writers" << std::endl;
+        return 1;
+    }
+    if (mode == "stress") {
+        return stress(options);
+    }
+    if (mode == "pipeline") {
+        return pipelineBench(options);
+    }
+    if (mode == "reclaim") {
+        return reclaimBench(options);
+    }
+    if (mode == "tasks") {
+        return taskBench(options);
+    }
+#ifndef _WIN32
+    if (mode == "poll") {
+        return pollBench(options);
+    }
+#endif
+    if (mode == "snapshot") {
+        return snapshotBench(options);
+    }
+    if (mode == "startup") {
+        return startupBench(options);
+    }
+    if (mode == "janitor") {
+        return janitor(options);
+    }
+    if (mode == "contention") {
+        return contentionBench(options.getInt("threads", std::max(2, (int)std::thread::hardware_concurrency())),
+                               options.getInt("iterations", 200000));
+    }
+    if (mode == "sem") {
+        return semBench(options.getInt("iterations", 200000));
+    }
+    if (mode == "copy") {
+        return copyBench();
+    }
+    if (mode == "crc") {
+        return crcBench();
+    }
+    if (mode == "lz") {
+        return lzBench();
+    }
+    std::cout << "Unknown mode: " << mode << std::endl;
+    return 1;
+}
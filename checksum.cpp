@@ -0,0 +1,136 @@
+#include "checksum.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC_X86
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC compiles any intrinsic as is, GCC and Clang need the ISA enabled per function
+#if defined(CRC_X86) && !defined(_MSC_VER)
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define TARGET(isa)
+#endif
+
+namespace {
+
+// Reflected Castagnoli polynomial
+const uint32_t POLY = 0x82f63b78;
+
+struct Tables {
+    uint32_t t[8][256];
+
+    Tables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (POLY & (0u - (crc & 1)));
+            }
+            t[0][i] = crc;
+        }
+        // t[k][i] is the CRC of byte i followed by k zero bytes
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+const Tables& tables() {
+    static const Tables instance;
+    return instance;
+}
+
+uint32_t crcTable(uint32_t crc, const void* data, size_t size) {
+    const Tables& tab = tables();
+    auto p = (const unsigned char*)data;
+    crc = ~crc;
+    for (; size >= 8; size -= 8, p += 8) {
+        // Little-endian word order, which is every CPU this builds for
+        uint32_t low;
+        uint32_t high;
+        std::memcpy(&low, p, 4);
+        std::memcpy(&high, p + 4, 4);
+        low ^= crc;
+        crc = tab.t[7][low & 0xff] ^ tab.t[6][(low >> 8) & 0xff] ^ tab.t[5][(low >> 16) & 0xff] ^ tab.t[4][low >> 24]
+            ^ tab.t[3][high & 0xff] ^ tab.t[2][(high >> 8) & 0xff] ^ tab.t[1][(high >> 16) & 0xff] ^ tab.t[0][high >> 24];
+    }
+    for (; size > 0; --size, ++p) {
+        crc = (crc >> 8) ^ tab.t[0][(crc ^ *p) & 0xff];
+    }
+    return ~crc;
+}
+
+#ifdef CRC_X86
+
+bool detectSse42() {
+    unsigned regs[4];
+#ifdef _MSC_VER
+    __cpuidex((int*)regs, 1, 0);
+#else
+    __cpuid_count(1, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    return (regs[2] & (1u << 20)) != 0;
+}
+
+TARGET("sse4.2") uint32_t crcSse42(uint32_t crc, const void* data, size_t size) {
+    auto p = (const unsigned char*)data;
+    uint64_t crc64 = ~crc;
+    for (; size >= 8; size -= 8, p += 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    auto crc32 = (uint32_t)crc64;
+    for (; size > 0; --size, ++p) {
+        crc32 = _mm_crc32_u8(crc32, *p);
+    }
+    return ~crc32;
+}
+
+#endif
+
+}
+
+uint32_t crc32c(const void* data, size_t size, uint32_t crc) {
+    static const CrcFunc function = crcFunction(bestCrcKernel());
+    return function(crc, data, size);
+}
+
+CrcKernel bestCrcKernel() {
+    return crcKernelSupported(CrcKernel::Sse42) ? CrcKernel::Sse42 : CrcKernel::Table;
+}
+
+bool crcKernelSupported(CrcKernel kernel) {
+#ifdef CRC_X86
+    static const bool sse42 = detectSse42();
+    if (kernel == CrcKernel::Sse42) {
+        return sse42;
+    }
+#endif
+    return kernel == CrcKernel::Table;
+}
+
+const char* crcKernelName(CrcKernel kernel) {
+    switch (kernel) {
+    case CrcKernel::Sse42: return "sse4.2";
+    default: return "table";
+    }
+}
+
+CrcFunc crcFunction(CrcKernel kernel) {
+#ifdef CRC_X86
+    if (kernel == CrcKernel::Sse42 && crcKernelSupported(kernel)) {
+        return crcSse42;
+    }
+#endif
+    return crcTable;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum class CrcKernel {
+    // Slicing-by-8 tables, eight bytes per step on any CPU
+    Table,
+    // SSE4.2 crc32 instruction
+    Sse42,
+};
+
+using CrcFunc = uint32_t (*)(uint32_t crc, const void* data, size_t size);
+
+// CRC32C (Castagnoli) of the bytes, continuing from crc so pieces can be chained.
+// The kernel is picked once from CPUID on first use.
+uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0);
+
+CrcKernel bestCrcKernel();
+bool crcKernelSupported(CrcKernel kernel);
+const char* crcKernelName(CrcKernel kernel);
+CrcFunc crcFunction(CrcKernel kernel);
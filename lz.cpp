@@ -0,0 +1,160 @@
+#include "lz.h"
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 65535;
+const int HASH_BITS = 12;
+
+uint32_t read32(const char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Bytes a length takes beyond its nibble: 15 in the token, then runs of 255
+size_t extraBytes(size_t length) {
+    return length >= 15 ? (length - 15) / 255 + 1 : 0;
+}
+
+char* writeLength(char* op, size_t length) {
+    if (length < 15) {
+        return op;
+    }
+    for (length -= 15; length >= 255; length -= 255) {
+        *op++ = (char)255;
+    }
+    *op++ = (char)length;
+    return op;
+}
+
+bool readLength(const unsigned char*& ip, const unsigned char* end, size_t& length) {
+    if (length != 15) {
+        return true;
+    }
+    unsigned char byte;
+    do {
+        if (ip == end) {
+            return false;
+        }
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Most literals a final run can carry in the space left
+size_t literalsFitting(size_t literals, size_t space) {
+    if (space == 0) {
+        return 0;
+    }
+    size_t count = std::min(literals, space - 1);
+    while (count > 0 && 1 + extraBytes(count) + count > space) {
+        --count;
+    }
+    return count;
+}
+
+char* emitLiterals(char* op, const char* literals, size_t count, size_t matchNibble) {
+    *op++ = (char)((std::min<size_t>(count, 15) << 4) | matchNibble);
+    op = writeLength(op, count);
+    std::memcpy(op, literals, count);
+    return op + count;
+}
+
+}
+
+size_t lzCompress(const char* src, size_t srcSize, char* dst, size_t dstCapacity, size_t& consumed) {
+    // Positions plus one, zero is an empty slot
+    uint32_t table[1 << HASH_BITS] = {};
+    size_t ip = 0;
+    size_t anchor = 0;
+    char* op = dst;
+    char* end = dst + dstCapacity;
+    while (ip + MIN_MATCH <= srcSize) {
+        uint32_t value = read32(src + ip);
+        uint32_t& entry = table[hash(value)];
+        size_t candidate = entry;
+        entry = (uint32_t)(ip + 1);
+        if (candidate == 0 || ip - (candidate - 1) > MAX_OFFSET || read32(src + candidate - 1) != value) {
+            // Skip faster through data that does not match, like LZ4 does
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+        size_t match = candidate - 1;
+        size_t length = MIN_MATCH;
+        while (ip + length < srcSize && src[match + length] == src[ip + length]) {
+            ++length;
+        }
+        size_t literals = ip - anchor;
+        size_t need = 1 + extraBytes(literals) + literals + 2 + extraBytes(length - MIN_MATCH);
+        if (need > (size_t)(end - op)) {
+            break;
+        }
+        op = emitLiterals(op, src + anchor, literals, std::min<size_t>(length - MIN_MATCH, 15));
+        size_t offset = ip - match;
+        *op++ = (char)(offset & 0xff);
+        *op++ = (char)(offset >> 8);
+        op = writeLength(op, length - MIN_MATCH);
+        ip += length;
+        anchor = ip;
+    }
+    // Whatever is left goes out as literals, as far as they fit
+    size_t literals = literalsFitting(srcSize - anchor, end - op);
+    if (literals > 0) {
+        op = emitLiterals(op, src + anchor, literals, 0);
+    }
+    consumed = anchor + literals;
+    return op - dst;
+}
+
+bool lzDecompress(const char* src, size_t srcSize, char* dst, size_t dstSize) {
+    auto ip = (const unsigned char*)src;
+    auto end = ip + srcSize;
+    size_t op = 0;
+    while (ip < end) {
+        unsigned token = *ip++;
+        size_t literals = token >> 4;
+        if (!readLength(ip, end, literals) || literals > (size_t)(end - ip) || literals > dstSize - op) {
+            return false;
+        }
+        std::memcpy(dst + op, ip, literals);
+        ip += literals;
+        op += literals;
+        // The last sequence has no match
+        if (ip == end) {
+            break;
+        }
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t length = token & 15;
+        if (!readLength(ip, end, length)) {
+            return false;
+        }
+        length += MIN_MATCH;
+        if (offset == 0 || offset > op || length > dstSize - op) {
+            return false;
+        }
+        if (offset >= length) {
+            std::memcpy(dst + op, dst + op - offset, length);
+        } else {
+            // Overlapping match, repeats the last offset bytes
+            for (size_t i = 0; i < length; ++i) {
+                dst[op + i] = dst[op + i - offset];
+            }
+        }
+        op += length;
+    }
+    return op == dstSize;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+
+// Small LZ77 codec in the LZ4 mould: a token with literal and match lengths, the literals,
+// a two-byte offset. Every block stands alone, nothing outside this file is needed to read it.
+
+// Compresses from the start of src until dst is full or src runs out. Returns the bytes written,
+// consumed says how much of src they hold. Incompressible input comes out about as long as it went in.
+size_t lzCompress(const char* src, size_t srcSize, char* dst, size_t dstCapacity, size_t& consumed);
+
+// Decodes a whole block, which must come out exactly dstSize long. False on malformed input.
+bool lzDecompress(const char* src, size_t srcSize, char* dst, size_t dstSize);
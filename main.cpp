@@ -6,6 +6,11 @@
 #include "StatusScreen.h"
 #include "MessagePopup.h"
 #include "utils.h"
+#include "PagePool.h"
+#include "EventLoop.h"
+#include "Options.h"
+#include "platform.h"
+#include "affinity.h"
 
 #include <memory>
 #include <cstdio>
@@ -15,6 +20,9 @@
 #include <random>
 #include <fstream>
 #include <cstdint>
+#include <vector>
+#include <cstring>
+#include <atomic>
 
 int randInt(int a, int b) {
     static std::random_device rd;
@@ -23,40 +31,6 @@ int randInt(int a, int b) {
     return distrib(gen);
 }
 
-struct Page {
-    volatile char data[4*1024];
-};
-
-struct Pages {
-    Page pages[12];
-};
-
-enum class PageState : uint8_t {
-    CanWrite = 0,
-    Busy,
-    CanRead
-};
-
-struct SharedObject {
-    volatile PageState pageStates[12];
-
-    int takePage(bool isChit) {
-        PageState searchState = isChit ? PageState::CanRead : PageState::CanWrite;
-        for (int i = 0; i < 12; ++i) {
-            if (pageStates[i] == searchState) {
-                pageStates[i] = PageState::Busy;
-                return i;
-            }
-        }
-        return -1;
-    }
-
-    void returnPage(int page, bool isChit) {
-        PageState newState = isChit ? PageState::CanWrite : PageState::CanRead;
-        pageStates[page] = newState;
-    }
-};
-
 void _fixwcout() {
     constexpr char cp_utf16le[] = ".1200";
     setlocale( LC_ALL, cp_utf16le );
@@ -78,87 +52,6 @@ void ticker(int timeMs, const std::function<bool(int)>& callback) {
     }
 }
 
-class Semaphore {
-public:
-    Semaphore(const std::wstring& name, int initial, int max) {
-        sem = CreateSemaphoreW(nullptr, initial, max, name.c_str());
-    }
-
-    ~Semaphore() {
-        CloseHandle(sem);
-    }
-
-    void acquire() {
-        WaitForSingleObject(sem, INFINITE);
-    }
-
-    void release() {
-        ReleaseSemaphore(sem, 1, nullptr);
-    }
-
-private:
-    HANDLE sem;
-};
-
-class Mutex {
-friend class MutexLock;
-public:
-    explicit Mutex(const std::wstring& name) {
-        mutex = CreateMutexW(nullptr, FALSE, name.c_str());
-    }
-
-    ~Mutex() {
-        CloseHandle(mutex);
-    }
-
-private:
-    void lock() {
-        WaitForSingleObject(mutex, INFINITE);
-    }
-
-    void unlock() {
-        ReleaseMutex(mutex);
-    }
-
-    HANDLE mutex;
-};
-
-class MutexLock {
-public:
-    explicit MutexLock(Mutex& mut) : mut(mut) {
-        mut.lock();
-    }
-
-    ~MutexLock() {
-        mut.unlock();
-    }
-private:
-    Mutex& mut;
-};
-
-template<typename T>
-class MemMapping {
-public:
-    explicit MemMapping(const std::wstring& name) {
-        mapFile = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE | SEC_COMMIT, 0, sizeof(T), name.c_str());
-        mapView = MapViewOfFile(mapFile, FILE_MAP_ALL_ACCESS, 0, 0, 0);
-        VirtualLock(mapView, sizeof(T));
-    }
-
-    ~MemMapping() {
-        VirtualUnlock(mapView, sizeof(T));
-        UnmapViewOfFile(mapView);
-        CloseHandle(mapFile);
-    }
-
-    T* data() {
-        return (T*)mapView;
-    }
-private:
-    void* mapView;
-    HANDLE mapFile;
-};
-
 class LogFile {
 public:
     explicit LogFile(const std::string& name)
@@ -177,145 +70,203 @@ private:
 
 class Worker {
 public:
-    void singleRun(const std::function<bool()>& process);
+    // Batch after batch until running goes false, as a task of the UI thread's event loop
+    Task run(EventLoop& loop, const std::atomic<bool>& running);
 
     virtual bool isChit() const = 0;
-    virtual Semaphore& inputSem() = 0;
-    virtual Semaphore& outputSem() = 0;
-    virtual void processBuf(Page& page) = 0;
+    virtual void processPage(PageSpan page) = 0;
+
+    bool valid() const;
+    const PoolGeometry& geometry() const;
+    PagePool& pagePool();
+    // With several workers in the process log lines say which one wrote them
+    void note(const std::string& text);
 
     virtual ~Worker();
 
 protected:
-    Worker(StatusScreen& status, LogFile& log);
+    Worker(StatusScreen& status, LogFile& log, const std::shared_ptr<PoolMapping>& mapping, int task, int tasks, int batchSize);
 
-    Mutex mutex;
-    Semaphore pagesToWriteSemaphore;
-    Semaphore pagesToReadSemaphore;
-    MemMapping<SharedObject> mapShared;
-    MemMapping<Pages> mapPages;
+    PagePool pool;
+    int batchSize;
+    int task;
+    std::string prefix;
     StatusScreen& status;
     LogFile& log;
-
-    char buf[sizeof(Page)];
 };
 
-void Worker::singleRun(const std::function<bool()>& process) {
-    log.write("WAIT");
-    status.updateState(State::Waiting);
-    if (!process()) {
-        return;
-    }
+Task Worker::run(EventLoop& loop, const std::atomic<bool>& running) {
+    using namespace std::chrono;
+    while (running) {
+        note("WAIT");
+        status.updateState(task, State::Waiting);
+
+        // The batch below will wait for budget, say so instead of looking stuck
+        if (!isChit() && pool.overBudget()) {
+            note("OVER BUDGET");
+        }
 
-    inputSem().acquire();
+        // Readers drain whatever backlog there is in one wake-up, writers fill free pages back to back
+        uint64_t corrupted = pool.integrity().corrupted;
+        PageBatch batch = isChit() ? co_await pool.acquireRead(batchSize) : co_await pool.acquireWrite(batchSize);
+        if (pool.integrity().corrupted > corrupted) {
+            note("CORRUPT " + std::to_string(pool.integrity().corrupted - corrupted));
+        }
 
-    int page;
-    {
-        MutexLock lock(mutex);
-        page = mapShared.data()->takePage(isChit());
-    }
+        State st = isChit() ? State::Reading : State::Writing;
+        for (int i = 0; i < batch.size(); ++i) {
+            int page = batch.index(i);
+            note(isChit() ? "READ " + std::to_string(batch.sequence(i)) : "WRITE");
+            status.updateState(task, st, page);
+            if (!running) {
+                break;
+            }
+            processPage(batch.span(i));
+
+            int localWait = randInt(500, 1500);
+            auto start = steady_clock::now();
+            for (int elapsed = 0; elapsed < localWait && running; elapsed = (int)duration_cast<milliseconds>(steady_clock::now() - start).count()) {
+                status.updateState(task, st, page, elapsed / (float) localWait);
+                co_await loop.sleep(milliseconds(std::min(100, localWait - elapsed)));
+            }
+        }
 
-    log.write(isChit() ? "READ" : "WRITE");
-    State st = isChit() ? State::Reading : State::Writing;
-    status.updateState(st, page);
-    if (process()) {
-        processBuf(mapPages.data()->pages[page]);
-
-        int localWait = randInt(500, 1500);
-        ticker(localWait, [&](int elapsed) {
-            float progress = elapsed / (float) localWait;
-            status.updateState(st, page, progress);
-            return process();
-        });
+        note("WAIT");
+        status.updateState(task, State::Waiting);
+        int count = batch.size();
+        uint64_t sequence = batch.release();
+        if (!isChit()) {
+            note("COMMIT " + std::to_string(sequence) + " x" + std::to_string(count));
+        }
     }
+}
 
-    log.write("WAIT");
-    status.updateState(State::Waiting);
-    process();
-    {
-        MutexLock lock(mutex);
-        mapShared.data()->returnPage(page, isChit());
+// Drives the window between the workers' steps, the loop ends once frame() says so
+Task ui(EventLoop& loop, const std::function<bool()>& frame) {
+    while (frame()) {
+        co_await loop.sleep(std::chrono::milliseconds(50));
     }
+    loop.stop();
+}
+
+bool Worker::valid() const {
+    return pool.valid();
+}
+
+const PoolGeometry& Worker::geometry() const {
+    return pool.geometry();
+}
 
-    outputSem().release();
+PagePool& Worker::pagePool() {
+    return pool;
 }
 
 Worker::~Worker() = default;
 
-Worker::Worker(StatusScreen& status, LogFile& log)
-        : mutex(L"SharedMemMutex")
-        , pagesToWriteSemaphore(L"PagesToWriteSemaphore", 12, 12)
-        , pagesToReadSemaphore(L"PagesToReadSemaphore", 0, 12)
-        , mapShared(L"MapShared")
-        , mapPages(L"MapPages")
+Worker::Worker(StatusScreen& status, LogFile& log, const std::shared_ptr<PoolMapping>& mapping, int task, int tasks, int batchSize)
+        : pool(mapping)
+        , batchSize(batchSize)
+        , task(task)
+        , prefix(tasks > 1 ? "#" + std::to_string(task) + " " : "")
         , status(status)
         , log(log)
 {}
 
+void Worker::note(const std::string& text) {
+    log.write(prefix + text);
+}
+
 class Chitatel : public Worker {
 public:
-    explicit Chitatel(StatusScreen& status, LogFile& log) : Worker(status, log) {}
+    Chitatel(StatusScreen& status, LogFile& log, const std::shared_ptr<PoolMapping>& mapping, int task, int tasks, int batchSize)
+        : Worker(status, log, mapping, task, tasks, batchSize)
+    {}
 
     bool isChit() const override {
         return true;
     }
 
-    Semaphore& inputSem() override {
-        return pagesToReadSemaphore;
-    }
-
-    Semaphore& outputSem() override {
-        return pagesToWriteSemaphore;
-    }
-
-    void processBuf(Page& page) override {
-        for (int i = 0; i < sizeof(buf); ++i) {
-            buf[i] = page.data[i];
-        }
+    void processPage(PageSpan page) override {
+        note("GOT " + std::string(page.data, strnlen(page.data, page.size)));
     }
 };
 
 class Pisatel : public Worker {
 public:
-    explicit Pisatel(StatusScreen& status, LogFile& log) : Worker(status, log) {}
+    Pisatel(StatusScreen& status, LogFile& log, const std::shared_ptr<PoolMapping>& mapping, int task, int tasks, int batchSize)
+        : Worker(status, log, mapping, task, tasks, batchSize)
+    {}
 
     bool isChit() const override {
         return false;
     }
 
-    Semaphore& inputSem() override {
-        return pagesToWriteSemaphore;
+    void processPage(PageSpan page) override {
+        std::snprintf(page.data, page.size, "message %d.%d", task, ++written);
     }
 
-    Semaphore& outputSem() override {
-        return pagesToReadSemaphore;
-    }
-
-    void processBuf(Page& page) override {
-        for (int i = 0; i < sizeof(buf); ++i) {
-            page.data[i] = buf[i];
-        }
-    }
+private:
+    int written = 0;
 };
 
 int main(int argc, char* argv[]) {
     _fixwcout();
 
     if (argc < 4) {
-        std::wcout << L"USAGE: chit-pis.exe (chit|pis) number waitMs" << std::endl;
+        std::wcout << L"USAGE: chit-pis.exe (chit|pis) number waitMs [--pages N] [--page-size S] [--batch N] [--broadcast] [--channel NAME] [--cpus LIST] [--node N]\n"
+                   << L"                     [--file PATH] [--flush-ms N] [--budget] [--fairness race|fifo|readers|writers] [--tasks N]\n"
+                   << L"                     [--steal] [--checksums] [--huge-pages] [--prefault]" << std::endl;
         return 1;
     }
     bool isChit = argv[1] == std::string("chit");
     int number = std::atoi(argv[2]);
     int waitMs = std::atoi(argv[3]);
+    Options options(argc, argv, 4);
+    PoolGeometry geometry;
+    geometry.pagesCount = options.getInt("pages", geometry.pagesCount);
+    geometry.pageSize = options.getSize("page-size", geometry.pageSize);
+    if (options.has("broadcast")) {
+        geometry.mode = PoolMode::Broadcast;
+    }
+    geometry.budgets = options.has("budget");
+    geometry.stealing = options.has("steal");
+    geometry.checksums = options.has("checksums");
+    if (!parseFairness(options.get("fairness", "race"), geometry.fairness)) {
+        std::wcout << L"Fairness is race, fifo, readers or writers" << std::endl;
+        return 1;
+    }
+    geometry = geometry.normalized();
+    int batchSize = std::max(1, options.getInt("batch", 1));
+    // Workers of one process are tasks on its one thread, sharing the mapping, the kernel handles and this window
+    int tasks = std::max(1, options.getInt("tasks", 1));
+    // Pins the one thread that runs the UI and every worker
+    std::vector<int> cpus = parseCpuList(options.get("cpus"));
+    if (!cpus.empty()) {
+        pinThread(cpus);
+    }
+    int node = options.getInt("node", -1);
+    // Keeps the pool in a file, so what is in flight survives a reboot
+    PoolFile file;
+    file.path = options.get("file");
+    file.flushIntervalMs = options.getInt("flush-ms", file.flushIntervalMs);
+    // Fewer TLB misses on big pools, and no page faults in the middle of the first batches
+    MapOptions memory;
+    memory.hugePages = options.has("huge-pages");
+    memory.prefault = options.has("prefault");
+    // Only processes on the same channel talk to each other
+    std::wstring channel = widen(options.get("channel"));
+    if (!PagePool::validChannel(channel)) {
+        std::wcout << L"Channel names are made of letters, digits, '-' and '_'" << std::endl;
+        return 1;
+    }
 
-    Screen s(30, 12);
+    Screen s(28 + StatusScreen::pageDigits(geometry.pagesCount), 12);
     std::wstring title = isChit ? L"ЧИТАТЕЛЬ №" : L"ПИСАТЕЛЬ №";
     title += std::to_wstring(number);
     s.setTitle(title);
 
-    bool running = true;
-    StatusScreen status(isChit, number, waitMs);
+    std::atomic<bool> running{true};
+    StatusScreen status(isChit, number, waitMs, geometry.pagesCount, tasks);
 
     // Drawing
     auto repaint = [&]() {
@@ -344,7 +295,7 @@ int main(int argc, char* argv[]) {
         }
         status.tickAnim();
         repaint();
-        return running;
+        return running.load();
     };
 
     // Waiting loop
@@ -353,18 +304,67 @@ int main(int argc, char* argv[]) {
         return loop();
     });
 
-    LogFile log(std::string("logfile_") + (isChit ? "_chit_" : "_pis_") + std::to_string(number) + ".log");
-    std::unique_ptr<Worker> worker;
-    if (isChit) {
-        worker = std::make_unique<Chitatel>(status, log);
-    } else {
-        worker = std::make_unique<Pisatel>(status, log);
+    LogFile log(std::string("logfile_") + options.get("channel") + (isChit ? "_chit_" : "_pis_") + std::to_string(number) + ".log");
+    // The UI keeps a pool object of its own for NUMA placement, reclaim and flushes
+    PagePool control(PagePool::open(geometry, channel, file, memory));
+    if (!control.valid()) {
+        log.write("INCOMPATIBLE POOL");
+        return 1;
+    }
+    // The pool may have been created by someone else with another geometry
+    status.setPagesCount(control.geometry().pagesCount);
+    if (node >= 0 && !control.placeOnNode(node)) {
+        log.write("NO NUMA NODE " + std::to_string(node));
+    }
+    double remote = remoteShare(control.pageNodes(), currentNode());
+    log.write("NUMA NODE " + std::to_string(currentNode()) + ", REMOTE PAGES " + std::to_string((int)(remote * 100)) + "%");
+    if (memory.hugePages) {
+        log.write(std::string("PAGES ON ") + backingName(control.backing()));
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int task = 0; task < tasks; ++task) {
+        if (isChit) {
+            workers.push_back(std::make_unique<Chitatel>(status, log, control.mapping(), task, tasks, batchSize));
+        } else {
+            workers.push_back(std::make_unique<Pisatel>(status, log, control.mapping(), task, tasks, batchSize));
+        }
     }
 
-    // Main loop
+    // Main loop, workers are tasks next to the UI on this thread and the UI stays responsive while they wait
     log.write("START");
-    while (running) {
-        worker->singleRun(loop);
+    EventLoop events;
+    for (auto& worker : workers) {
+        events.spawn(worker->run(events, running));
+    }
+    auto lastReclaim = std::chrono::steady_clock::now();
+    std::function<bool()> frame = [&]() {
+        // Pages of workers that were killed mid-page would be lost for good otherwise
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastReclaim > std::chrono::seconds(1)) {
+            lastReclaim = now;
+            int reclaimed = control.reclaim();
+            if (reclaimed > 0) {
+                log.write("RECLAIMED " + std::to_string(reclaimed));
+            }
+        }
+        return loop();
+    };
+    events.spawn(ui(events, frame));
+    // Workers still waiting for pages are dropped, the pages they hold go back to the pool
+    events.run();
+    control.flush();
+    for (auto& worker : workers) {
+        WaitStats waits = worker->pagePool().waitStats(isChit);
+        if (waits.acquires > 0) {
+            worker->note("WAITS " + std::to_string(waits.acquires) + " MEAN " + std::to_string(waits.totalNs / waits.acquires / 1000)
+                         + " US MAX " + std::to_string(waits.maxNs / 1000) + " US");
+        }
+        const IntegrityStats& integrity = worker->pagePool().integrity();
+        if (integrity.verified > 0) {
+            worker->note("VERIFIED " + std::to_string(integrity.verified) + " CORRUPTED " + std::to_string(integrity.corrupted)
+                         + " REORDERED " + std::to_string(integrity.reordered) + " LOST " + std::to_string(integrity.lost));
+        }
     }
     log.write("STOP");
-}
+}
\ No newline at end of file
@@ -0,0 +1,260 @@
+#include "pagecopy.h"
+
+#include <cstring>
+#include <cstdint>
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define COPY_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC compiles any intrinsic as is, GCC and Clang need the ISA enabled per function
+#if defined(COPY_X86) && !defined(_MSC_VER)
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define TARGET(isa)
+#endif
+
+namespace {
+
+void copyScalar(void* dst, const void* src, size_t size) {
+    std::memcpy(dst, src, size);
+}
+
+#ifdef COPY_X86
+
+struct CpuFeatures {
+    bool sse2 = false;
+    bool avx2 = false;
+    bool avx512 = false;
+};
+
+void cpuid(int leaf, int subleaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+    __cpuidex((int*)regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+uint64_t xgetbv() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+CpuFeatures detectFeatures() {
+    CpuFeatures features;
+    unsigned regs[4];
+    cpuid(0, 0, regs);
+    unsigned maxLeaf = regs[0];
+
+    cpuid(1, 0, regs);
+    features.sse2 = (regs[3] & (1u << 26)) != 0;
+    // The OS has to save the wide registers too, not just the CPU have them
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    uint64_t xcr0 = osxsave ? xgetbv() : 0;
+    bool osYmm = (xcr0 & 0x6) == 0x6;
+    bool osZmm = (xcr0 & 0xe6) == 0xe6;
+
+    if (maxLeaf >= 7) {
+        cpuid(7, 0, regs);
+        features.avx2 = osYmm && (regs[1] & (1u << 5)) != 0;
+        features.avx512 = osZmm && (regs[1] & (1u << 16)) != 0;
+    }
+    return features;
+}
+
+const CpuFeatures& cpuFeatures() {
+    static const CpuFeatures features = detectFeatures();
+    return features;
+}
+
+// Each kernel copies an unaligned head with memcpy so the vector stores are aligned,
+// then the bulk in blocks of four vectors, then the tail with memcpy.
+size_t alignHead(char*& d, const char*& s, size_t size, size_t alignment) {
+    size_t head = (alignment - ((uintptr_t)d & (alignment - 1))) & (alignment - 1);
+    if (head > size) {
+        head = size;
+    }
+    std::memcpy(d, s, head);
+    d += head;
+    s += head;
+    return size - head;
+}
+
+template<bool Streaming>
+void copySse2(void* dst, const void* src, size_t size) {
+    auto d = (char*)dst;
+    auto s = (const char*)src;
+    size = alignHead(d, s, size, 16);
+    for (; size >= 64; size -= 64, d += 64, s += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)s);
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i*)(s + 48));
+        if (Streaming) {
+            _mm_stream_si128((__m128i*)d, a);
+            _mm_stream_si128((__m128i*)(d + 16), b);
+            _mm_stream_si128((__m128i*)(d + 32), c);
+            _mm_stream_si128((__m128i*)(d + 48), e);
+        } else {
+            _mm_store_si128((__m128i*)d, a);
+            _mm_store_si128((__m128i*)(d + 16), b);
+            _mm_store_si128((__m128i*)(d + 32), c);
+            _mm_store_si128((__m128i*)(d + 48), e);
+        }
+    }
+    if (Streaming) {
+        _mm_sfence();
+    }
+    std::memcpy(d, s, size);
+}
+
+template<bool Streaming>
+TARGET("avx2") void copyAvx2(void* dst, const void* src, size_t size) {
+    auto d = (char*)dst;
+    auto s = (const char*)src;
+    size = alignHead(d, s, size, 32);
+    for (; size >= 128; size -= 128, d += 128, s += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)s);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(s + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i*)(s + 96));
+        if (Streaming) {
+            _mm256_stream_si256((__m256i*)d, a);
+            _mm256_stream_si256((__m256i*)(d + 32), b);
+            _mm256_stream_si256((__m256i*)(d + 64), c);
+            _mm256_stream_si256((__m256i*)(d + 96), e);
+        } else {
+            _mm256_store_si256((__m256i*)d, a);
+            _mm256_store_si256((__m256i*)(d + 32), b);
+            _mm256_store_si256((__m256i*)(d + 64), c);
+            _mm256_store_si256((__m256i*)(d + 96), e);
+        }
+    }
+    if (Streaming) {
+        _mm_sfence();
+    }
+    _mm256_zeroupper();
+    std::memcpy(d, s, size);
+}
+
+template<bool Streaming>
+TARGET("avx512f") void copyAvx512(void* dst, const void* src, size_t size) {
+    auto d = (char*)dst;
+    auto s = (const char*)src;
+    size = alignHead(d, s, size, 64);
+    for (; size >= 256; size -= 256, d += 256, s += 256) {
+        __m512i a = _mm512_loadu_si512((const void*)s);
+        __m512i b = _mm512_loadu_si512((const void*)(s + 64));
+        __m512i c = _mm512_loadu_si512((const void*)(s + 128));
+        __m512i e = _mm512_loadu_si512((const void*)(s + 192));
+        if (Streaming) {
+            _mm512_stream_si512((__m512i*)d, a);
+            _mm512_stream_si512((__m512i*)(d + 64), b);
+            _mm512_stream_si512((__m512i*)(d + 128), c);
+            _mm512_stream_si512((__m512i*)(d + 192), e);
+        } else {
+            _mm512_store_si512((void*)d, a);
+            _mm512_store_si512((void*)(d + 64), b);
+            _mm512_store_si512((void*)(d + 128), c);
+            _mm512_store_si512((void*)(d + 192), e);
+        }
+    }
+    if (Streaming) {
+        _mm_sfence();
+    }
+    _mm256_zeroupper();
+    std::memcpy(d, s, size);
+}
+
+#endif
+
+struct Dispatch {
+    CopyFunc cached;
+    CopyFunc streaming;
+};
+
+Dispatch pickDispatch() {
+    CopyKernel kernel = bestCopyKernel();
+    return {copyFunction(kernel, false), copyFunction(kernel, true)};
+}
+
+}
+
+void copyPage(void* dst, const void* src, size_t size) {
+    static const Dispatch dispatch = pickDispatch();
+    if (size >= STREAMING_THRESHOLD) {
+        dispatch.streaming(dst, src, size);
+    } else {
+        dispatch.cached(dst, src, size);
+    }
+}
+
+CopyKernel bestCopyKernel() {
+    for (CopyKernel kernel : {CopyKernel::Avx512, CopyKernel::Avx2, CopyKernel::Sse2}) {
+        if (copyKernelSupported(kernel)) {
+            return kernel;
+        }
+    }
+    return CopyKernel::Scalar;
+}
+
+bool copyKernelSupported(CopyKernel kernel) {
+#ifdef COPY_X86
+    switch (kernel) {
+        case CopyKernel::Scalar:
+            return true;
+        case CopyKernel::Sse2:
+            return cpuFeatures().sse2;
+        case CopyKernel::Avx2:
+            return cpuFeatures().avx2;
+        case CopyKernel::Avx512:
+            return cpuFeatures().avx512;
+    }
+    return false;
+#else
+    return kernel == CopyKernel::Scalar;
+#endif
+}
+
+const char* copyKernelName(CopyKernel kernel) {
+    switch (kernel) {
+        case CopyKernel::Scalar:
+            return "scalar";
+        case CopyKernel::Sse2:
+            return "sse2";
+        case CopyKernel::Avx2:
+            return "avx2";
+        case CopyKernel::Avx512:
+            return "avx512";
+    }
+    return "";
+}
+
+CopyFunc copyFunction(CopyKernel kernel, bool streaming) {
+#ifdef COPY_X86
+    switch (kernel) {
+        case CopyKernel::Scalar:
+            return copyScalar;
+        case CopyKernel::Sse2:
+            return streaming ? copySse2<true> : copySse2<false>;
+        case CopyKernel::Avx2:
+            return streaming ? copyAvx2<true> : copyAvx2<false>;
+        case CopyKernel::Avx512:
+            return streaming ? copyAvx512<true> : copyAvx512<false>;
+    }
+#endif
+    return copyScalar;
+}
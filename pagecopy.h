@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+enum class CopyKernel {
+    Scalar,
+    Sse2,
+    Avx2,
+    Avx512,
+};
+
+using CopyFunc = void (*)(void* dst, const void* src, size_t size);
+
+// Copies this large no longer fit in cache next to their source,
+// so they bypass it with non-temporal stores
+static const size_t STREAMING_THRESHOLD = 2*1024*1024;
+
+// Copy engine for page payloads, the kernel is picked once from CPUID on first use
+void copyPage(void* dst, const void* src, size_t size);
+
+CopyKernel bestCopyKernel();
+bool copyKernelSupported(CopyKernel kernel);
+const char* copyKernelName(CopyKernel kernel);
+CopyFunc copyFunction(CopyKernel kernel, bool streaming);
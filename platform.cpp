@@ -0,0 +1,124 @@
+#include "platform.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#include <chrono>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define HAS_PAUSE
+#endif
+
+std::string posixName(const std::wstring& name) {
+    std::string result = "/";
+    for (wchar_t c : name) {
+        result += (char)c;
+    }
+    return result;
+}
+
+std::wstring widen(const std::string& name) {
+    return std::wstring(name.begin(), name.end());
+}
+
+int parseSize(const std::string& text) {
+    char* end = nullptr;
+    long value = std::strtol(text.c_str(), &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        value *= 1024;
+    } else if (*end == 'm' || *end == 'M') {
+        value *= 1024 * 1024;
+    }
+    return (int)value;
+}
+
+uint32_t processId() {
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return (uint32_t)getpid();
+#endif
+}
+
+bool processAlive(uint32_t pid) {
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+    if (!process) {
+        return GetLastError() == ERROR_ACCESS_DENIED;
+    }
+    bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+uint64_t monotonicMs() {
+    // CLOCK_MONOTONIC and QueryPerformanceCounter are both system wide
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+uint64_t bootId() {
+#ifdef _WIN32
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    uint64_t seconds = ((uint64_t)now.dwHighDateTime << 32 | now.dwLowDateTime) / 10000000;
+    return seconds - GetTickCount64() / 1000;
+#else
+    // A UUID, folded into 64 bits
+    static const uint64_t id = []() {
+        std::ifstream file("/proc/sys/kernel/random/boot_id");
+        uint64_t result = 0;
+        int digits = 0;
+        for (char c; file.get(c);) {
+            int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (digit >= 0) {
+                result ^= (uint64_t)digit << (4 * (digits++ % 16));
+            }
+        }
+        return result;
+    }();
+    return id;
+#endif
+}
+
+bool sameBoot(uint64_t first, uint64_t second) {
+    if (first == 0 || second == 0) {
+        return true;
+    }
+#ifdef _WIN32
+    // Boots lie further apart than any clock step
+    const uint64_t SLACK_SECONDS = 30;
+    return (first > second ? first - second : second - first) <= SLACK_SECONDS;
+#else
+    return first == second;
+#endif
+}
+
+void cpuRelax() {
+#ifdef HAS_PAUSE
+    _mm_pause();
+#endif
+}
+
+void systemFailure(const char* call, const std::string& object) {
+#ifdef _WIN32
+    std::fprintf(stderr, "%s %s failed: error %lu\n", call, object.c_str(), GetLastError());
+#else
+    std::fprintf(stderr, "%s %s failed: %s\n", call, object.c_str(), std::strerror(errno));
+#endif
+    std::abort();
+}
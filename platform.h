@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// Kernel object names are plain ASCII, POSIX wants them as narrow strings with a leading slash
+std::string posixName(const std::wstring& name);
+// The other way round, for names given on the command line
+std::wstring widen(const std::string& name);
+
+// Parses sizes like "4096", "64k" or "2M"
+int parseSize(const std::string& text);
+
+// Current process, never zero
+uint32_t processId();
+// False once the process is gone (and reaped, on POSIX)
+bool processAlive(uint32_t pid);
+// Milliseconds of a clock that all processes on the machine share
+uint64_t monotonicMs();
+// Tells boots of the machine apart, zero when it cannot be told. Windows has no boot id, there it is
+// the boot time in seconds, which clock adjustments move a little; compare with sameBoot.
+uint64_t bootId();
+// Zero matches any boot
+bool sameBoot(uint64_t first, uint64_t second);
+
+// Busy-wait hint for spin loops
+void cpuRelax();
+
+// A kernel object the pool cannot work without could not be made: prints the call, the object
+// and the system error, then aborts
+[[noreturn]] void systemFailure(const char* call, const std::string& object);